@@ -6,27 +6,148 @@
 //
 
 #include "Animation.hpp"
+#include "Animator.hpp"
+
+// Tracks per task when a batch is split over a pool
+static const size_t TRACK_BATCH_GRAIN_SIZE = 256;
+
+template<TrackType TYPE>
+static void SamplePositionBatch(const Bone *bones, const TrackRef *tracks, size_t count, float animationTime, BoneCursor *cursors, LocalPose &pose){
+    for(size_t i=0; i<count; i++){
+        const TrackRef &track = tracks[i];
+        glm::vec3 position = TrackSampler<TYPE>::Sample(bones[track.channel].GetPositionTrack(), animationTime, cursors[track.channel].position);
+        pose.translation[0][track.node] = position.x;
+        pose.translation[1][track.node] = position.y;
+        pose.translation[2][track.node] = position.z;
+    }
+}
+
+template<TrackType TYPE>
+static void SampleRotationBatch(const Bone *bones, const TrackRef *tracks, size_t count, float animationTime, BoneCursor *cursors, LocalPose &pose){
+    for(size_t i=0; i<count; i++){
+        const TrackRef &track = tracks[i];
+        glm::quat rotation = TrackSampler<TYPE>::Sample(bones[track.channel].GetRotationTrack(), animationTime, cursors[track.channel].rotation);
+        pose.rotation[0][track.node] = rotation.x;
+        pose.rotation[1][track.node] = rotation.y;
+        pose.rotation[2][track.node] = rotation.z;
+        pose.rotation[3][track.node] = rotation.w;
+    }
+}
+
+template<TrackType TYPE>
+static void SampleScaleBatch(const Bone *bones, const TrackRef *tracks, size_t count, float animationTime, BoneCursor *cursors, LocalPose &pose){
+    for(size_t i=0; i<count; i++){
+        const TrackRef &track = tracks[i];
+        glm::vec3 scale = TrackSampler<TYPE>::Sample(bones[track.channel].GetScaleTrack(), animationTime, cursors[track.channel].scale);
+        pose.scale[0][track.node] = scale.x;
+        pose.scale[1][track.node] = scale.y;
+        pose.scale[2][track.node] = scale.z;
+    }
+}
+
+typedef void (*TrackBatchSampler)(const Bone*, const TrackRef*, size_t, float, BoneCursor*, LocalPose&);
+
+// Indexed by component then type
+static const TrackBatchSampler TRACK_BATCH_SAMPLERS[TRACK_COMPONENT_COUNT][TRACK_TYPE_COUNT] = {
+    { SamplePositionBatch<TRACK_CONSTANT>, SamplePositionBatch<TRACK_STEP>, SamplePositionBatch<TRACK_LINEAR>, SamplePositionBatch<TRACK_UNIFORM> },
+    { SampleRotationBatch<TRACK_CONSTANT>, SampleRotationBatch<TRACK_STEP>, SampleRotationBatch<TRACK_LINEAR>, SampleRotationBatch<TRACK_UNIFORM> },
+    { SampleScaleBatch<TRACK_CONSTANT>, SampleScaleBatch<TRACK_STEP>, SampleScaleBatch<TRACK_LINEAR>, SampleScaleBatch<TRACK_UNIFORM> }
+};
 
 Animation::Animation(){
     
 }
 
 Animation::Animation(const std::string &animationPath, Model *model){
-    Assimp::Importer importer;
-    const aiScene *scene = importer.ReadFile(animationPath, aiProcess_Triangulate);
-    assert(scene && scene->mRootNode);
-    auto animation = scene->mAnimations[0];
-    mDuration = animation->mDuration;
-    mTicksPerSecond = animation->mTicksPerSecond;
-    ReadHeirarchyData(mRootNode, scene->mRootNode);
-    ReadMissingBones(animation, *model);
+    mSkeleton = model->GetSkeleton();
+    
+    std::string cachePath = animationPath + CLIP_FILE_EXTENSION;
+    mClipFile = ClipFile::Open(cachePath, *mSkeleton, animationPath);
+    if(mClipFile){
+        LOGGER("Loaded clip cache "+cachePath);
+    }else{
+        Assimp::Importer importer;
+        const aiScene *scene = importer.ReadFile(animationPath, aiProcess_Triangulate);
+        assert(scene && scene->mRootNode);
+        mClipFile = ClipFile::Import(scene->mAnimations[0], *mSkeleton, animationPath);
+        mClipFile->Write(cachePath);
+    }
+    
+    const ClipFileHeader &header = mClipFile->GetHeader();
+    mDuration = header.duration;
+    mTicksPerSecond = (int)header.ticksPerSecond;
+    BindChannels();
+    BuildTrackBatches();
+}
+
+Animation::Animation(const std::shared_ptr<const Skeleton> &skeleton){
+    mSkeleton = skeleton;
+    mDuration = 1.0f;
+    mTicksPerSecond = 1;
+    mNodeChannels.assign(mSkeleton->GetNodes().size(), -1);
 }
 
 Animation::~Animation(){
     
 }
 
-Bone* Animation::FindBone(const std::string &name){
+bool Animation::BakePoses(float sampleRate, size_t memoryCap){
+    float durationSeconds = mDuration / mTicksPerSecond;
+    int frameCount = std::max(1, (int)ceil(durationSeconds * sampleRate));
+    
+    // Solve one frame first to learn the palette size
+    Animator animator(this);
+    animator.SetAnimationTime(0.0f);
+    int paletteSize = (int)animator.GetFinalBoneMatrices().size();
+    
+    size_t bakedSize = (size_t)frameCount * paletteSize * sizeof(glm::mat4);
+    if(bakedSize > memoryCap){
+        LOGGER("Not baking poses, "+std::to_string(bakedSize)+" bytes needed for "+std::to_string(frameCount)+" frames is over the cap of "+std::to_string(memoryCap));
+        return false;
+    }
+    
+    std::vector<glm::mat4> palettes;
+    palettes.reserve((size_t)frameCount * paletteSize);
+    for(int frame=0; frame<frameCount; frame++){
+        animator.SetAnimationTime((frame / sampleRate) * mTicksPerSecond);
+        const std::vector<glm::mat4> &palette = animator.GetFinalBoneMatrices();
+        palettes.insert(palettes.end(), palette.begin(), palette.end());
+    }
+    
+    mBakedPalettes.swap(palettes);
+    mBakedSampleRate = sampleRate;
+    mBakedFrameCount = frameCount;
+    mBakedPaletteSize = paletteSize;
+    LOGGER("Baked "+std::to_string(frameCount)+" poses, "+std::to_string(bakedSize)+" bytes");
+    return true;
+}
+
+void Animation::SamplePose(float animationTime, std::vector<BoneCursor> &cursors, int skeletonLOD, LocalPose &pose, ThreadPool *pool) const{
+    skeletonLOD = std::max(0, std::min(skeletonLOD, MAX_SKELETON_LOD));
+    pose = mSkeleton->GetBindPose();
+    
+    bool parallel = pool && mSkeleton->GetLOD(skeletonLOD).evaluatedNodes.size() >= PARALLEL_SOLVE_MIN_NODES;
+    for(int component=0; component<TRACK_COMPONENT_COUNT; component++){
+        for(int type=0; type<TRACK_TYPE_COUNT; type++){
+            const std::vector<TrackRef> &batch = mTrackBatches[skeletonLOD][component][type];
+            if(batch.empty()){
+                continue;
+            }
+            
+            TrackBatchSampler sampler = TRACK_BATCH_SAMPLERS[component][type];
+            if(parallel){
+                // Tracks of a batch write to separate nodes and cursors
+                pool->ParallelFor(batch.size(), TRACK_BATCH_GRAIN_SIZE, [&](size_t begin, size_t end){
+                    sampler(mBones.data(), batch.data() + begin, end - begin, animationTime, cursors.data(), pose);
+                });
+            }else{
+                sampler(mBones.data(), batch.data(), batch.size(), animationTime, cursors.data(), pose);
+            }
+        }
+    }
+}
+
+const Bone* Animation::FindBone(const std::string &name) const{
     auto iter = std::find_if(mBones.begin(), mBones.end(), [&](const Bone& bone){
         return bone.GetBoneName() == name;
     });
@@ -38,37 +159,49 @@ Bone* Animation::FindBone(const std::string &name){
     }
 }
 
-void Animation::ReadMissingBones(const aiAnimation* animation, Model& model){
-    int size = animation->mNumChannels;
+void Animation::BindChannels(){
+    mNodeChannels.assign(mSkeleton->GetNodes().size(), -1);
     
-    // TODO: Check
-    auto boneInfoMap = model.GetBoneInfoMap();
-    int boneCount = model.GetBoneCount();
-    
-    //reading channels(bones engaged in an animation and their keyframes)
-    for (int i = 0; i < size; i++)
-    {
-        auto channel = animation->mChannels[i];
-        std::string boneName = channel->mNodeName.data;
-        if(boneInfoMap.find(boneName) == boneInfoMap.end()){
-            boneInfoMap[boneName].id = boneCount;
-            boneCount++;
-        }
-        mBones.push_back(Bone(channel->mNodeName.data, boneInfoMap[channel->mNodeName.data].id, channel));
+    // Channels were matched to nodes when the clip was imported
+    const ClipFileHeader &header = mClipFile->GetHeader();
+    mBones.reserve(header.channelCount);
+    for(uint32_t i=0; i<header.channelCount; i++){
+        const ClipFileChannel &channel = mClipFile->GetChannel(i);
+        mNodeChannels[channel.node] = (int)mBones.size();
+        mBones.push_back(Bone(mClipFile->GetName(channel), channel.boneId,
+                              mClipFile->GetTrack<glm::vec3>(channel.positions),
+                              mClipFile->GetTrack<glm::quat>(channel.rotations),
+                              mClipFile->GetTrack<glm::vec3>(channel.scales)));
     }
-    mBoneInfoMap = boneInfoMap;
 }
 
-void Animation::ReadHeirarchyData(AssimpNodeData& dest, const aiNode* src){
-    assert(src);
-    
-    dest.name = src->mName.data;
-    dest.transformation = AssimpGLMHelpers::ConvertMatrixToGLMFormat(src->mTransformation);
-    dest.childrenCount = src->mNumChildren;
+void Animation::BuildTrackBatches(){
+    for(int level=0; level<=MAX_SKELETON_LOD; level++){
+        // Skeleton order, so neighbouring tracks write to neighbouring nodes
+        const std::vector<int> &evaluatedNodes = mSkeleton->GetLOD(level).evaluatedNodes;
+        for(size_t n=0; n<evaluatedNodes.size(); n++){
+            TrackRef track;
+            track.node = evaluatedNodes[n];
+            track.channel = mNodeChannels[track.node];
+            if(track.channel < 0){
+                continue;
+            }
+            
+            const Bone &bone = mBones[track.channel];
+            mTrackBatches[level][TRACK_POSITION][bone.GetPositionTrack().type].push_back(track);
+            mTrackBatches[level][TRACK_ROTATION][bone.GetRotationTrack().type].push_back(track);
+            mTrackBatches[level][TRACK_SCALE][bone.GetScaleTrack().type].push_back(track);
+        }
+    }
     
-    for(int i=0; i<src->mNumChildren; i++){
-        AssimpNodeData newData;
-        ReadHeirarchyData(newData, src->mChildren[i]);
-        dest.children.push_back(newData);
+    const char *typeNames[TRACK_TYPE_COUNT] = { "constant", "step", "linear", "uniform" };
+    std::string summary;
+    for(int type=0; type<TRACK_TYPE_COUNT; type++){
+        size_t count = 0;
+        for(int component=0; component<TRACK_COMPONENT_COUNT; component++){
+            count += mTrackBatches[0][component][type].size();
+        }
+        summary += " "+std::to_string(count)+" "+typeNames[type];
     }
+    LOGGER("Animation tracks:"+summary);
 }
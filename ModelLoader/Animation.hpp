@@ -18,48 +18,102 @@
 #include <assimp/postprocess.h>
 #include <vector>
 #include <string>
-#include <map>
+#include <memory>
+#include <algorithm>
+#include <cassert>
 
 #include "assimp_glm_helper.h"
 #include "Model.hpp"
+#include "Skeleton.hpp"
 #include "Bone.hpp"
+#include "LocalPose.hpp"
+#include "ThreadPool.hpp"
+#include "ClipFile.hpp"
 
-struct AssimpNodeData{
-    glm::mat4 transformation;
-    std::string name;
-    int childrenCount;
-    std::vector<AssimpNodeData> children;
+enum TrackComponent{
+    TRACK_POSITION,
+    TRACK_ROTATION,
+    TRACK_SCALE,
+    TRACK_COMPONENT_COUNT
 };
 
+/* Track of one channel, and the skeleton node it drives */
+struct TrackRef{
+    int channel;
+    int node;
+};
+
+/* Keyframe data loaded from a file. It is read-only once constructed so a single
+    Animation can be shared by any number of Animators, including across threads.
+    The hierarchy is not part of the clip: channels are bound once at load to the nodes
+    of the model's Skeleton, which every clip of that model shares. The bound keys are
+    cached next to the source file (see ClipFile), later runs map the cache instead of
+    importing the scene again */
 class Animation{
 public:
     Animation();
     Animation(const std::string &animationPath, Model *model);
+    /* Clip without channels, every node of the skeleton holds its bind pose */
+    explicit Animation(const std::shared_ptr<const Skeleton> &skeleton);
     ~Animation();
     
-    Bone* FindBone(const std::string &name);
+    /* Opt-in memory for speed mode for short looping clips: solves the palette of the
+        whole clip at sampleRate frames per second now, so Animators only blend two baked
+        palettes per update. Does nothing and returns false if the palettes would take more
+        than memoryCap bytes, playback then stays live. Call before sharing the clip */
+    bool BakePoses(float sampleRate, size_t memoryCap = 4 * 1024 * 1024);
     
-    inline float GetTicksPerSecond() { return mTicksPerSecond; }
-
-    inline float GetDuration() { return mDuration;}
+    inline bool HasBakedPoses() const { return mBakedFrameCount > 0; }
+    inline float GetBakedSampleRate() const { return mBakedSampleRate; }
+    inline int GetBakedFrameCount() const { return mBakedFrameCount; }
+    
+    /* Palette of a baked frame, GetBakedPaletteSize() matrices */
+    inline const glm::mat4* GetBakedPalette(int frame) const { return &mBakedPalettes[frame * mBakedPaletteSize]; }
+    inline int GetBakedPaletteSize() const { return mBakedPaletteSize; }
+    
+    const Bone* FindBone(const std::string &name) const;
+    
+    inline float GetTicksPerSecond() const { return mTicksPerSecond; }
 
-    inline const AssimpNodeData& GetRootNode() { return mRootNode; }
+    inline float GetDuration() const { return mDuration;}
 
-    inline const std::map<std::string,BoneInfo>& GetBoneIDMap()
-    {
-        return mBoneInfoMap;
-    }
+    inline const std::vector<Bone>& GetBones() const { return mBones; }
+    
+    inline const Skeleton* GetSkeleton() const { return mSkeleton.get(); }
+    
+    /* Index in GetBones() of the channel driving a skeleton node, -1 if the node keeps
+        its bind pose in this clip */
+    inline int GetNodeChannel(int node) const { return mNodeChannels[node]; }
+    
+    /* Samples every node evaluated at a skeleton LOD level into pose, nodes without keys
+        get the bind pose. Tracks are walked in batches of one type so each batch runs a
+        single sampler. With a pool, large batches are split over its workers */
+    void SamplePose(float animationTime, std::vector<BoneCursor> &cursors, int skeletonLOD, LocalPose &pose, ThreadPool *pool = nullptr) const;
+    
+    /* Tracks of one component and type, for the nodes evaluated at a skeleton LOD level */
+    inline const std::vector<TrackRef>& GetTrackBatch(int skeletonLOD, TrackComponent component, TrackType type) const
+        {
+            return mTrackBatches[skeletonLOD][component][type];
+        }
     
 private:
     // Properties
     float mDuration;
     int mTicksPerSecond;
     std::vector<Bone> mBones;
-    AssimpNodeData mRootNode;
-    std::map<std::string, BoneInfo> mBoneInfoMap;
+    std::shared_ptr<const Skeleton> mSkeleton;
+    std::shared_ptr<ClipFile> mClipFile;        // Owns the keys mBones point into
+    std::vector<int> mNodeChannels;             // Per skeleton node
+    std::vector<TrackRef> mTrackBatches[MAX_SKELETON_LOD + 1][TRACK_COMPONENT_COUNT][TRACK_TYPE_COUNT];
+    
+    // -- Baked poses
+    std::vector<glm::mat4> mBakedPalettes;      // mBakedFrameCount palettes of mBakedPaletteSize matrices
+    float mBakedSampleRate = 0.0f;
+    int mBakedFrameCount = 0;
+    int mBakedPaletteSize = 0;
 
     // Functions
-    void ReadMissingBones(const aiAnimation* animation, Model& model);
-    void ReadHeirarchyData(AssimpNodeData& dest, const aiNode* src);
+    void BindChannels();
+    void BuildTrackBatches();
 };
 #endif /* Animation_hpp */
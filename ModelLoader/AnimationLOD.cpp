@@ -0,0 +1,71 @@
+//
+//  AnimationLOD.cpp
+//  ModelLoader
+//
+//  Created by Apple on 19/10/26.
+//
+
+#include "AnimationLOD.hpp"
+
+float AnimationLOD::ComputeScreenSize(const glm::vec3 &center, float radius, const glm::mat4 &view, const glm::mat4 &projection){
+    glm::vec4 viewCenter = view * glm::vec4(center, 1.0f);
+    float distance = -viewCenter.z;
+    
+    // Camera inside the sphere, it can't get any bigger
+    if(distance <= radius){
+        return 1.0f;
+    }
+    
+    // projection[1][1] is cot(fovy / 2), so this is the projected diameter over the NDC height of 2
+    return (radius * projection[1][1]) / distance;
+}
+
+bool AnimationLOD::IsVisible(const glm::vec3 &center, float radius, const glm::mat4 &viewProjection){
+    glm::vec4 position(center, 1.0f);
+    
+    // Planes are sums and differences of the rows of the view projection matrix
+    glm::vec4 row0(viewProjection[0][0], viewProjection[1][0], viewProjection[2][0], viewProjection[3][0]);
+    glm::vec4 row1(viewProjection[0][1], viewProjection[1][1], viewProjection[2][1], viewProjection[3][1]);
+    glm::vec4 row2(viewProjection[0][2], viewProjection[1][2], viewProjection[2][2], viewProjection[3][2]);
+    glm::vec4 row3(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+    glm::vec4 planes[6] = { row3 + row0, row3 - row0, row3 + row1, row3 - row1, row3 + row2, row3 - row2 };
+    
+    for(int i=0; i<6; i++){
+        float normalLength = glm::length(glm::vec3(planes[i]));
+        if(glm::dot(planes[i], position) < -radius * normalLength){
+            return false;
+        }
+    }
+    return true;
+}
+
+int AnimationLOD::ComputeUpdateInterval(const AnimationLODPolicy &policy, float screenSize, bool visible){
+    if(!visible && policy.freezeOffScreen){
+        return 0;
+    }
+    if(screenSize >= policy.fullRateScreenSize){
+        return 1;
+    }
+    if(screenSize >= policy.halfRateScreenSize){
+        return 2;
+    }
+    if(screenSize >= policy.quarterRateScreenSize){
+        return 4;
+    }
+    return 8;
+}
+
+int AnimationLOD::ComputeSkeletonLOD(const AnimationLODPolicy &policy, float screenSize){
+    int level = 0;
+    while(level < MAX_SKELETON_LOD && screenSize < policy.skeletonLODScreenSize[level]){
+        level++;
+    }
+    return level;
+}
+
+int AnimationLOD::ComputeUpdateInterval(const AnimationLODPolicy &policy, const glm::vec3 &center, float radius,
+                                        const glm::mat4 &view, const glm::mat4 &projection){
+    bool visible = IsVisible(center, radius, projection * view);
+    float screenSize = ComputeScreenSize(center, radius, view, projection);
+    return ComputeUpdateInterval(policy, screenSize, visible);
+}
@@ -0,0 +1,47 @@
+//
+//  AnimationLOD.hpp
+//  ModelLoader
+//
+//  Created by Apple on 19/10/26.
+//
+
+#ifndef AnimationLOD_hpp
+#define AnimationLOD_hpp
+
+#include <stdio.h>
+#include <glm/glm.hpp>
+
+#include "Skeleton.hpp"
+
+/* Screen size thresholds (fraction of the viewport height covered by the character's
+    bounding sphere) below which an animator is updated less often */
+struct AnimationLODPolicy{
+    float fullRateScreenSize = 0.25f;       // Every frame
+    float halfRateScreenSize = 0.12f;       // Every 2nd frame
+    float quarterRateScreenSize = 0.05f;    // Every 4th frame, every 8th below that
+    bool freezeOffScreen = true;            // Stop updating when outside the view frustum
+    
+    // Screen sizes below which skeleton LOD 1, 2 and 3 are used, one per level past 0
+    float skeletonLODScreenSize[MAX_SKELETON_LOD] = { 0.15f, 0.08f, 0.04f };
+};
+
+/* Picks how often an Animator is updated from the size of the character on screen */
+class AnimationLOD{
+public:
+    /* Height of the bounding sphere on screen as a fraction of the viewport height */
+    static float ComputeScreenSize(const glm::vec3 &center, float radius, const glm::mat4 &view, const glm::mat4 &projection);
+    
+    /* Conservative sphere against view frustum test */
+    static bool IsVisible(const glm::vec3 &center, float radius, const glm::mat4 &viewProjection);
+    
+    /* Update interval for Animator::SetUpdateInterval: 1, 2, 4 or 8 frames, 0 when frozen */
+    static int ComputeUpdateInterval(const AnimationLODPolicy &policy, float screenSize, bool visible);
+    
+    /* Level for Animator::SetSkeletonLOD, 0 = every bone */
+    static int ComputeSkeletonLOD(const AnimationLODPolicy &policy, float screenSize);
+    
+    /* Everything in one go, for a character whose bounds are the given sphere */
+    static int ComputeUpdateInterval(const AnimationLODPolicy &policy, const glm::vec3 &center, float radius,
+                                     const glm::mat4 &view, const glm::mat4 &projection);
+};
+#endif /* AnimationLOD_hpp */
@@ -0,0 +1,77 @@
+//
+//  AnimationTexture.cpp
+//  ModelLoader
+//
+//  Created by Apple on 19/10/26.
+//
+
+#include "AnimationTexture.hpp"
+
+AnimationTexture::AnimationTexture(const std::vector<const Animation*> &clips, int boneCount, float sampleRate)
+        : mTextureID(0), mBoneCount(boneCount), mFrameCount(0), mSampleRate(sampleRate){
+    if(clips.size() > MAX_BAKED_CLIPS){
+        LOGGER("ERROR::ANIMATIONTEXTURE:: Only "+std::to_string(MAX_BAKED_CLIPS)+" clips can be baked, ignoring the rest");
+    }
+    
+    std::vector<glm::vec4> texels;
+    for(unsigned int i=0; i<clips.size() && i<MAX_BAKED_CLIPS; i++){
+        BakeClip(clips[i], texels);
+    }
+    
+    // Bake the texture
+    glGenTextures(1, &mTextureID);
+    GLState::BindTexture(GL_TEXTURE_2D, mTextureID);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, mBoneCount * 3, mFrameCount, 0, GL_RGBA, GL_FLOAT, texels.empty() ? NULL : &texels[0]);
+    
+    // Matrices are fetched texel by texel, filtering would mix unrelated bones
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    GLState::BindTexture(GL_TEXTURE_2D, 0);
+    
+    LOGGER("Baked "+std::to_string(mClips.size())+" clips into a "+std::to_string(mBoneCount * 3)+"*"+std::to_string(mFrameCount)+" animation texture");
+}
+
+AnimationTexture::~AnimationTexture(){
+    GLState::DeleteTextures(1, &mTextureID);
+}
+
+void AnimationTexture::Bind(Shader &shader, unsigned int textureUnit){
+    GLState::BindTextureUnit(textureUnit, GL_TEXTURE_2D, mTextureID);
+    
+    shader.setInteger("bakedBones", textureUnit);
+    shader.setFloat("bakedSampleRate", mSampleRate);
+    for(unsigned int i=0; i<mClips.size(); i++){
+        std::string uniformClip = std::string("bakedClips[")+ std::to_string(i) +std::string("]");
+        shader.setVector2f(uniformClip.c_str(), (float)mClips[i].firstFrame, (float)mClips[i].frameCount);
+    }
+}
+
+void AnimationTexture::BakeClip(const Animation *clip, std::vector<glm::vec4> &texels){
+    BakedClip baked;
+    baked.firstFrame = mFrameCount;
+    
+    // Duration is in ticks, the texture is sampled in seconds
+    float durationSeconds = clip->GetDuration() / clip->GetTicksPerSecond();
+    baked.frameCount = std::max(1, (int)ceil(durationSeconds * mSampleRate));
+    
+    Animator animator(clip);
+    for(int frame=0; frame<baked.frameCount; frame++){
+        float frameTime = (frame / mSampleRate) * clip->GetTicksPerSecond();
+        animator.SetAnimationTime(frameTime);
+        
+        const std::vector<glm::mat4> &palette = animator.GetFinalBoneMatrices();
+        for(int bone=0; bone<mBoneCount; bone++){
+            glm::mat4 matrix = bone < (int)palette.size() ? palette[bone] : glm::mat4(1.0f);
+            
+            // glm is column major, store the rows so the shader can rebuild the matrix
+            for(int row=0; row<3; row++){
+                texels.push_back(glm::vec4(matrix[0][row], matrix[1][row], matrix[2][row], matrix[3][row]));
+            }
+        }
+    }
+    
+    mFrameCount += baked.frameCount;
+    mClips.push_back(baked);
+}
@@ -0,0 +1,56 @@
+//
+//  AnimationTexture.hpp
+//  ModelLoader
+//
+//  Created by Apple on 19/10/26.
+//
+
+#ifndef AnimationTexture_hpp
+#define AnimationTexture_hpp
+
+#include <stdio.h>
+#include <GL/glew.h>
+#include <vector>
+
+#include "Animator.hpp"
+#include "Shader.hpp"
+
+// Must match MAX_BAKED_CLIPS in animation_baked.vs
+#define MAX_BAKED_CLIPS 16
+
+struct BakedClip{
+    int firstFrame;     // Row of the first frame in the texture
+    int frameCount;
+};
+
+/* Bone matrices of whole clips sampled at a fixed rate and stored in a float texture.
+    Each row is one frame, each bone takes 3 RGBA texels holding the first three rows of
+    its matrix (the last row of an affine matrix is always 0,0,0,1). Skinned instances
+    then fetch their palette in the vertex shader and need no CPU animation at all */
+class AnimationTexture{
+public:
+    // -- Constructors and Destructor
+    AnimationTexture(const std::vector<const Animation*> &clips, int boneCount, float sampleRate = 30.0f);
+    ~AnimationTexture();
+    
+    /* Binds the texture to the given unit and sets the uniforms animation_baked.vs needs
+        to find a clip's frames */
+    void Bind(Shader &shader, unsigned int textureUnit);
+    
+    // -- Getters
+    unsigned int GetTextureID() const { return mTextureID; }
+    const std::vector<BakedClip>& GetClips() const { return mClips; }
+    float GetSampleRate() const { return mSampleRate; }
+    
+private:
+    // Properties
+    unsigned int mTextureID;
+    int mBoneCount;
+    int mFrameCount;
+    float mSampleRate;
+    std::vector<BakedClip> mClips;
+    
+    // Functions
+    void BakeClip(const Animation *clip, std::vector<glm::vec4> &texels);
+};
+#endif /* AnimationTexture_hpp */
@@ -7,52 +7,372 @@
 
 #include "Animator.hpp"
 
-Animator::Animator(Animation* animation){
+Animator::Animator(const Animation* animation){
     mCurrentTime = 0.0f;
+    mDeltaTime = 0.0f;
     mCurrentAnimation = animation;
+    mSkinningMode = SKINNING_LINEAR;
+    mUpdateInterval = 1;
+    mUpdatePhase = 0;
+    mFrameCounter = 0;
+    mFramesSinceUpdate = 0;
+    mPendingTime = 0.0f;
+    mSkeletonLOD = 0;
+    mPoseCache = nullptr;
+    mCachedPalette = nullptr;
+    mThreadPool = nullptr;
+    mFadeAnimation = nullptr;
+    mFadeTime = 0.0f;
+    mFadeElapsed = 0.0f;
+    mFadeDuration = 0.0f;
     
-    mFinalBoneMatrices.reserve(100);
-    
-    for(int i=0; i<100; i++){
-        mFinalBoneMatrices.push_back(glm::mat4(1.0f));
-    }
+    ResetPoseState();
 }
 
 void Animator::UpdateAnimation(float dt){
     mDeltaTime = dt;
+    mPendingTime += dt;
+    mFrameCounter++;
+    mFramesSinceUpdate++;
+    
+    // Frozen, or not this animator's turn yet
+    if(mUpdateInterval == 0 || (mFrameCounter + mUpdatePhase) % mUpdateInterval != 0){
+        // A shared palette only lives for a frame more, keep our own copy
+        if(mCachedPalette){
+            mFinalBoneMatrices = *mCachedPalette;
+            mCachedPalette = nullptr;
+        }
+        return;
+    }
+    
     if(mCurrentAnimation){
-        mCurrentTime += mCurrentAnimation->GetTicksPerSecond() * dt;
+        mCurrentTime += mCurrentAnimation->GetTicksPerSecond() * mPendingTime;
         mCurrentTime = fmod(mCurrentTime, mCurrentAnimation->GetDuration());
-        CalculateBoneTransform(&mCurrentAnimation->GetRootNode(), glm::mat4(1.0f));
+        AdvanceBlendTimes(mPendingTime);
+        
+        if(mUpdateInterval > 1){
+            if(mCachedPalette){
+                mPreviousBoneMatrices = *mCachedPalette;
+            }else{
+                mPreviousBoneMatrices.swap(mFinalBoneMatrices);
+            }
+        }
+        EvaluatePose();
     }
+    mPendingTime = 0.0f;
+    mFramesSinceUpdate = 0;
 }
 
-void Animator::PlayAnimation(Animation* pAnimation){
+void Animator::PlayAnimation(const Animation* pAnimation){
     mCurrentAnimation = pAnimation;
     mCurrentTime = 0.0f;
+    mFadeAnimation = nullptr;
+    ResetPoseState();
 }
 
-void Animator::CalculateBoneTransform(const AssimpNodeData* node, glm::mat4 parentTransform){
-    std::string nodeName = node->name;
-    glm::mat4 nodeTransform = node->transformation;
+void Animator::CrossFade(const Animation* pAnimation, float duration){
+    if(!mCurrentAnimation || duration <= 0.0f){
+        PlayAnimation(pAnimation);
+        return;
+    }
+    assert(pAnimation->GetSkeleton() == mCurrentAnimation->GetSkeleton());
     
-    Bone *bone = mCurrentAnimation->FindBone(nodeName);
+    mFadeAnimation = mCurrentAnimation;
+    mFadeTime = mCurrentTime;
+    mFadeCursors.swap(mCursors);
+    mFadeElapsed = 0.0f;
+    mFadeDuration = duration;
+    
+    mCurrentAnimation = pAnimation;
+    mCurrentTime = 0.0f;
+    ResetPoseState();
+}
+
+int Animator::AddLayer(const Animation* clip, float weight, bool additive, const std::vector<float> &mask){
+    assert(mCurrentAnimation && clip->GetSkeleton() == mCurrentAnimation->GetSkeleton());
+    const Skeleton &skeleton = *clip->GetSkeleton();
     
-    if(bone){
-        bone->Update(mCurrentTime);
-        nodeTransform = bone->GetLocalTransform();
+    AnimationLayer layer;
+    layer.clip = clip;
+    layer.time = 0.0f;
+    layer.weight = weight;
+    layer.additive = additive;
+    layer.mask = mask;
+    if(!layer.mask.empty()){
+        layer.mask.resize(skeleton.GetBindPose().GetPaddedSize(), 0.0f);
     }
+    layer.cursors.resize(clip->GetBones().size());
     
-    glm::mat4 globalTransform = parentTransform * nodeTransform;
+    if(additive){
+        clip->SamplePose(0.0f, layer.cursors, 0, layer.reference);
+    }
     
-    auto boneInfoMap = mCurrentAnimation->GetBoneIDMap();
-    if(boneInfoMap.find(nodeName) != boneInfoMap.end()){
-        int index = boneInfoMap[nodeName].id;
-        glm::mat4 offset = boneInfoMap[nodeName].offset;
-        mFinalBoneMatrices[index] = globalTransform * offset;
+    mLayers.push_back(layer);
+    return (int)mLayers.size() - 1;
+}
+
+void Animator::SetLayerWeight(int layer, float weight){
+    mLayers[layer].weight = weight;
+}
+
+void Animator::RemoveLayer(int layer){
+    mLayers.erase(mLayers.begin() + layer);
+}
+
+void Animator::SetPoseCache(PoseCache *cache){
+    if(mCachedPalette){
+        mFinalBoneMatrices = *mCachedPalette;
+        mCachedPalette = nullptr;
     }
+    mPoseCache = cache;
+}
+
+void Animator::SetThreadPool(ThreadPool *pool){
+    mThreadPool = pool;
+}
+
+void Animator::SetSkinningMode(SkinningMode mode){
+    mSkinningMode = mode;
+    if(mSkinningMode == SKINNING_DUAL_QUATERNION){
+        mFinalBoneDualQuaternions.assign(mFinalBoneMatrices.size() * 2, glm::vec4(0.0f));
+        CalculateDualQuaternions();
+    }else{
+        mFinalBoneDualQuaternions.clear();
+    }
+}
+
+void Animator::SetUpdateInterval(int interval, int phase){
+    // Back to full rate, nothing left to interpolate from
+    if(interval == 1 && mUpdateInterval != 1){
+        mPreviousBoneMatrices = GetFinalBoneMatrices();
+    }
+    mUpdateInterval = interval;
+    mUpdatePhase = phase;
+}
+
+void Animator::SetSkeletonLOD(int level){
+    mSkeletonLOD = std::max(0, std::min(level, MAX_SKELETON_LOD));
+}
+
+AABB Animator::ComputeBounds() const{
+    return SkinnedBounds::Compute(mCurrentAnimation->GetSkeleton()->GetBoneBounds(), GetFinalBoneMatrices());
+}
+
+float Animator::GetPaletteBlend() const{
+    if(mUpdateInterval <= 1){
+        return 1.0f;
+    }
+    // Reaches the newest palette just as the next update is due
+    return std::min(1.0f, (mFramesSinceUpdate + 1) / (float)mUpdateInterval);
+}
+
+void Animator::SetAnimationTime(float animationTime){
+    if(mCurrentAnimation){
+        mCurrentTime = fmod(animationTime, mCurrentAnimation->GetDuration());
+        mCachedPalette = nullptr;
+        CalculateBoneTransforms();
+        if(mSkinningMode == SKINNING_DUAL_QUATERNION){
+            CalculateDualQuaternions();
+        }
+    }
+}
+
+void Animator::UpdateAnimations(const std::vector<Animator*> &animators, float dt, ThreadPool &pool){
+    // Animators are independent, a chunk of a few keeps the queue traffic low
+    pool.ParallelFor(animators.size(), 16, [&](size_t begin, size_t end){
+        for(size_t i=begin; i<end; i++){
+            animators[i]->UpdateAnimation(dt);
+        }
+    });
+}
+
+void Animator::ResetPoseState(){
+    mCachedPalette = nullptr;
+    mCursors.clear();
+    mGlobalTransforms.clear();
+    if(mCurrentAnimation){
+        mCursors.resize(mCurrentAnimation->GetBones().size());
+        mGlobalTransforms.resize(mCurrentAnimation->GetSkeleton()->GetNodes().size(), glm::mat4(1.0f));
+    }
+    ResizePalette();
+}
+
+void Animator::ResizePalette(){
+    // One entry per bone of the whole rig, each mesh gathers its slots through its paletteBones.
+    // Without a clip, a single draw's worth of identities
+    size_t boneCount = mCurrentAnimation ? mCurrentAnimation->GetSkeleton()->GetBoneCount() : MAX_PALETTE_BONES;
+    mFinalBoneMatrices.resize(boneCount, glm::mat4(1.0f));
+    mPreviousBoneMatrices.resize(boneCount, glm::mat4(1.0f));
+    if(mSkinningMode == SKINNING_DUAL_QUATERNION){
+        mFinalBoneDualQuaternions.resize(boneCount * 2, glm::vec4(0.0f));
+    }
+}
+
+void Animator::EvaluatePose(){
+    // Baked and cached palettes hold a single clip
+    if(IsBlending()){
+        mCachedPalette = nullptr;
+        CalculateBoneTransforms();
+    }else if(mCurrentAnimation->HasBakedPoses()){
+        EvaluateBakedPose();
+    }else if(mPoseCache){
+        EvaluateCachedPose();
+    }else{
+        CalculateBoneTransforms();
+    }
+    
+    if(mSkinningMode == SKINNING_DUAL_QUATERNION){
+        CalculateDualQuaternions();
+    }
+}
+
+void Animator::EvaluateCachedPose(){
+    float sampleTime = mCurrentTime;
+    long long timeIndex = mPoseCache->QuantizeTime(mCurrentTime, mCurrentAnimation->GetTicksPerSecond(), sampleTime);
+    
+    const std::vector<glm::mat4> *palette = mPoseCache->Find(mCurrentAnimation, timeIndex, mSkeletonLOD);
+    if(!palette){
+        // First animator at this time, solve the pose at the quantised time and share it
+        float currentTime = mCurrentTime;
+        mCurrentTime = fmod(sampleTime, mCurrentAnimation->GetDuration());
+        CalculateBoneTransforms();
+        mCurrentTime = currentTime;
+        palette = mPoseCache->Insert(mCurrentAnimation, timeIndex, mSkeletonLOD, mFinalBoneMatrices);
+    }
+    mCachedPalette = palette;
+}
+
+void Animator::EvaluateBakedPose(){
+    mCachedPalette = nullptr;
+    
+    // Baked frames are in seconds, the current time in ticks
+    int frameCount = mCurrentAnimation->GetBakedFrameCount();
+    float frameTime = (mCurrentTime / mCurrentAnimation->GetTicksPerSecond()) * mCurrentAnimation->GetBakedSampleRate();
+    int frame0 = std::min((int)frameTime, frameCount - 1);
+    int frame1 = (frame0 + 1) % frameCount;
+    float blend = std::min(1.0f, frameTime - frame0);
+    
+    const glm::mat4 *palette0 = mCurrentAnimation->GetBakedPalette(frame0);
+    const glm::mat4 *palette1 = mCurrentAnimation->GetBakedPalette(frame1);
+    int paletteSize = std::min(mCurrentAnimation->GetBakedPaletteSize(), (int)mFinalBoneMatrices.size());
+    for(int i=0; i<paletteSize; i++){
+        mFinalBoneMatrices[i] = palette0[i] * (1.0f - blend) + palette1[i] * blend;
+    }
+}
+
+void Animator::AdvanceBlendTimes(float seconds){
+    if(mFadeAnimation){
+        mFadeTime = fmod(mFadeTime + mFadeAnimation->GetTicksPerSecond() * seconds, mFadeAnimation->GetDuration());
+        mFadeElapsed += seconds;
+        if(mFadeElapsed >= mFadeDuration){
+            mFadeAnimation = nullptr;
+        }
+    }
+    for(size_t i=0; i<mLayers.size(); i++){
+        AnimationLayer &layer = mLayers[i];
+        layer.time = fmod(layer.time + layer.clip->GetTicksPerSecond() * seconds, layer.clip->GetDuration());
+    }
+}
+
+void Animator::SampleLocalPose(){
+    // Every clip lands in the same local space buffers, the hierarchy is solved once after
+    if(mFadeAnimation){
+        mFadeAnimation->SamplePose(mFadeTime, mFadeCursors, mSkeletonLOD, mLocalPose, mThreadPool);
+        mCurrentAnimation->SamplePose(mCurrentTime, mCursors, mSkeletonLOD, mLayerPose, mThreadPool);
+        PoseBlend::Blend(mLocalPose, mLayerPose, std::min(1.0f, mFadeElapsed / mFadeDuration), nullptr);
+    }else{
+        mCurrentAnimation->SamplePose(mCurrentTime, mCursors, mSkeletonLOD, mLocalPose, mThreadPool);
+    }
+    
+    for(size_t i=0; i<mLayers.size(); i++){
+        AnimationLayer &layer = mLayers[i];
+        if(layer.weight <= 0.0f){
+            continue;
+        }
+        
+        layer.clip->SamplePose(layer.time, layer.cursors, mSkeletonLOD, mLayerPose, mThreadPool);
+        const float *mask = layer.mask.empty() ? nullptr : layer.mask.data();
+        if(layer.additive){
+            PoseBlend::BlendAdditive(mLocalPose, mLayerPose, layer.reference, layer.weight, mask);
+        }else{
+            PoseBlend::Blend(mLocalPose, mLayerPose, layer.weight, mask);
+        }
+    }
+}
+
+void Animator::CalculateBoneTransforms(){
+    const SkeletonLOD &lod = mCurrentAnimation->GetSkeleton()->GetLOD(mSkeletonLOD);
+    const int *nodes = lod.evaluatedNodes.data();
+    size_t subtreeRuns = lod.subtreeRanges.size() - 1;
     
-    for(int i=0; i<node->childrenCount; i++){
-        CalculateBoneTransform(&node->children[i], globalTransform);
+    SampleLocalPose();
+    
+    if(mThreadPool && subtreeRuns > 1 && lod.evaluatedNodes.size() >= PARALLEL_SOLVE_MIN_NODES){
+        // Trunk first, then subtree runs in parallel. Runs share no node or palette entry
+        // and only read the trunk above them
+        SolveNodes(nodes, lod.trunkNodeCount);
+        
+        mSubtreeTimings.resize(subtreeRuns);
+        mThreadPool->ParallelFor(subtreeRuns, 1, [&](size_t begin, size_t end){
+            for(size_t run=begin; run<end; run++){
+                auto start = std::chrono::high_resolution_clock::now();
+                SolveNodes(nodes + lod.subtreeRanges[run], lod.subtreeRanges[run + 1] - lod.subtreeRanges[run]);
+                std::chrono::duration<float, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+                mSubtreeTimings[run] = elapsed.count();
+            }
+        });
+    }else{
+        SolveNodes(nodes, lod.evaluatedNodes.size());
+        mSubtreeTimings.clear();
+    }
+    
+    // Masked off bones ride along with their evaluated ancestor, one multiply each
+    for(size_t m=0; m<lod.maskedBones.size(); m++){
+        const SkeletonLOD::MaskedBone &masked = lod.maskedBones[m];
+        if(masked.boneId < (int)mFinalBoneMatrices.size()){
+            mFinalBoneMatrices[masked.boneId] = mGlobalTransforms[masked.ancestor] * masked.bindRelativeOffset;
+        }
+    }
+}
+
+void Animator::SolveNodes(const int *nodes, size_t count){
+    const Skeleton &skeleton = *mCurrentAnimation->GetSkeleton();
+    const std::vector<SkeletonNode> &skeletonNodes = skeleton.GetNodes();
+    
+    // Nodes are stored parent first, so a single forward pass resolves the hierarchy
+    for(size_t n=0; n<count; n++){
+        int i = nodes[n];
+        const SkeletonNode &node = skeletonNodes[i];
+        glm::mat4 nodeTransform = mLocalPose.GetMatrix(i);
+        
+        if(node.parent >= 0){
+            mGlobalTransforms[i] = mGlobalTransforms[node.parent] * nodeTransform;
+        }else{
+            mGlobalTransforms[i] = nodeTransform;
+        }
+        
+        if(node.boneId >= 0 && node.boneId < (int)mFinalBoneMatrices.size()){
+            mFinalBoneMatrices[node.boneId] = mGlobalTransforms[i] * skeleton.GetBoneOffset(node.boneId);
+        }
+    }
+}
+
+void Animator::CalculateDualQuaternions(){
+    const std::vector<glm::mat4> &palette = GetFinalBoneMatrices();
+    for(size_t i=0; i<palette.size(); i++){
+        const glm::mat4 &matrix = palette[i];
+        
+        // Rotation from the normalised basis, any scale in the matrix is dropped
+        glm::mat3 rotationMatrix(glm::normalize(glm::vec3(matrix[0])),
+                                 glm::normalize(glm::vec3(matrix[1])),
+                                 glm::normalize(glm::vec3(matrix[2])));
+        glm::quat real = glm::normalize(glm::quat_cast(rotationMatrix));
+        
+        // dual = 0.5 * translation * real
+        glm::vec3 translation = glm::vec3(matrix[3]);
+        glm::quat dual = glm::quat(0.0f, translation.x, translation.y, translation.z) * real * 0.5f;
+        
+        mFinalBoneDualQuaternions[i * 2 + 0] = glm::vec4(real.x, real.y, real.z, real.w);
+        mFinalBoneDualQuaternions[i * 2 + 1] = glm::vec4(dual.x, dual.y, dual.z, dual.w);
     }
 }
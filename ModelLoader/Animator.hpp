@@ -9,27 +9,156 @@
 #define Animator_hpp
 
 #include <stdio.h>
+#include <chrono>
 
 #include "Animation.hpp"
+#include "ThreadPool.hpp"
+#include "PoseCache.hpp"
 
+// Skeletons with fewer evaluated nodes than this are solved on the calling thread, the
+// task overhead would cost more than the split saves
+#define PARALLEL_SOLVE_MIN_NODES 512
+
+/* A clip blended over the base clip of an Animator */
+struct AnimationLayer{
+    const Animation *clip;
+    float time;
+    float weight;
+    bool additive;                      // Adds the clip's motion relative to its first frame
+    std::vector<float> mask;            // Per skeleton node weight, empty for the whole skeleton
+    std::vector<BoneCursor> cursors;
+    LocalPose reference;                // First frame of an additive clip
+};
+
+/* Plays one Animation. Everything that changes per frame (time, key cursors and pose
+    buffers) is owned here, the Animation is only read so many Animators can share it */
 class Animator{
 public:
     // Functions
-    Animator(Animation* Animation);
+    Animator(const Animation* Animation);
     void UpdateAnimation(float dt);
-    void PlayAnimation(Animation* pAnimation);
-    void CalculateBoneTransform(const AssimpNodeData* node, glm::mat4 parentTransform);
+    void PlayAnimation(const Animation* pAnimation);
+    
+    /* Fades from the current clip to pAnimation over duration seconds. Both clips are
+        sampled and blended until the fade ends, a fade already running is dropped */
+    void CrossFade(const Animation* pAnimation, float duration);
+    
+    /* Blends clip over the base clip with weight. A mask from Skeleton::MakeSubtreeMask
+        limits the layer to part of the body. Layers are applied in the order they were
+        added, returns the layer's index */
+    int AddLayer(const Animation* clip, float weight, bool additive = false, const std::vector<float> &mask = std::vector<float>());
+    void SetLayerWeight(int layer, float weight);
+    void RemoveLayer(int layer);
+    int GetLayerCount() const { return (int)mLayers.size(); }
+    
+    /* In dual quaternion mode the palette is also output as 2 vec4 per bone (real part
+        then dual part), half the size of the mat4 palette */
+    void SetSkinningMode(SkinningMode mode);
+    
+    /* Animation LOD: sample the clip only every interval frames (1 = every frame, 0 =
+        frozen). phase staggers animators sharing an interval, so they don't all update on
+        the same frame. Skipped frames still advance the time */
+    void SetUpdateInterval(int interval, int phase = 0);
+    
+    /* Skeleton LOD: 0 evaluates every node, up to MAX_SKELETON_LOD masks off more and
+        more of the small leaf bones (fingers, face) */
+    void SetSkeletonLOD(int level);
+    
+    /* Shares solved palettes with every other animator using the same cache. Time is
+        rounded to the cache's quantum, nullptr evaluates every frame on its own */
+    void SetPoseCache(PoseCache *cache);
+    
+    /* Solves the subtrees of large skeletons (cloth, hair) on the pool's workers once the
+        trunk is done. nullptr, or fewer than PARALLEL_SOLVE_MIN_NODES nodes, stays serial */
+    void SetThreadPool(ThreadPool *pool);
+    
+    /* Jumps to animationTime (in ticks) and evaluates the pose there */
+    void SetAnimationTime(float animationTime);
+    
+    /* Advances every animator by dt, spreading them over the pool's workers */
+    static void UpdateAnimations(const std::vector<Animator*> &animators, float dt, ThreadPool &pool);
     
     // -- Getters
-    std::vector<glm::mat4> GetFinalBoneMatrices()
+    const std::vector<glm::mat4>& GetFinalBoneMatrices() const
+        {
+            return mCachedPalette ? *mCachedPalette : mFinalBoneMatrices;
+        }
+    const std::vector<glm::vec4>& GetFinalBoneDualQuaternions() const
+        {
+            return mFinalBoneDualQuaternions;
+        }
+    SkinningMode GetSkinningMode() const { return mSkinningMode; }
+    
+    /* Palette of the update before the last one. Drawing
+        mix(previous, final, GetPaletteBlend()) spreads the motion of one update over the
+        frames until the next one */
+    const std::vector<glm::mat4>& GetPreviousBoneMatrices() const
         {
-            return mFinalBoneMatrices;
+            return mPreviousBoneMatrices;
         }
+    float GetPaletteBlend() const;
+    
+    /* Mesh space bounds of the current pose, from the skeleton's per bone boxes moved by
+        the palette. No vertex is skinned */
+    AABB ComputeBounds() const;
+    int GetUpdateInterval() const { return mUpdateInterval; }
+    int GetSkeletonLOD() const { return mSkeletonLOD; }
+    
+    /* Milliseconds spent on each subtree run by the last parallel solve, empty if the last
+        solve was serial */
+    const std::vector<float>& GetSubtreeTimings() const { return mSubtreeTimings; }
     
 private:
     std::vector<glm::mat4> mFinalBoneMatrices;
-        Animation* mCurrentAnimation;
+    std::vector<glm::vec4> mFinalBoneDualQuaternions;
+    SkinningMode mSkinningMode;
+    
+    // -- Animation LOD
+    std::vector<glm::mat4> mPreviousBoneMatrices;
+    int mUpdateInterval;
+    int mUpdatePhase;
+    int mFrameCounter;
+    int mFramesSinceUpdate;
+    float mPendingTime;                             // Seconds skipped since the last update
+    int mSkeletonLOD;
+    
+    // -- Pose cache
+    PoseCache *mPoseCache;
+    const std::vector<glm::mat4> *mCachedPalette;   // Palette shared through the cache this frame, if any
+        const Animation* mCurrentAnimation;
         float mCurrentTime;
         float mDeltaTime;
+    
+    // -- Blending
+    std::vector<AnimationLayer> mLayers;
+    const Animation* mFadeAnimation;                // Clip faded out from, nullptr when not fading
+    float mFadeTime;
+    float mFadeElapsed;
+    float mFadeDuration;
+    std::vector<BoneCursor> mFadeCursors;
+    LocalPose mLocalPose;                           // Pose being solved, blended when layers or a fade are active
+    LocalPose mLayerPose;
+    
+    // -- Parallel solve
+    ThreadPool *mThreadPool;
+    std::vector<float> mSubtreeTimings;
+    
+    // -- Pose state
+    std::vector<BoneCursor> mCursors;               // One per Bone of the current animation
+    std::vector<glm::mat4> mGlobalTransforms;       // One per node of the skeleton
+    
+    // Functions
+    void ResetPoseState();
+    /* Sizes the palettes to the bone count of the clip's skeleton */
+    void ResizePalette();
+    void EvaluatePose();
+    void EvaluateCachedPose();
+    void EvaluateBakedPose();
+    bool IsBlending() const { return mFadeAnimation || !mLayers.empty(); }
+    void AdvanceBlendTimes(float seconds);
+    void SampleLocalPose();
+    void CalculateBoneTransforms();
+    void SolveNodes(const int *nodes, size_t count);
+    void CalculateDualQuaternions();
 };
 #endif /* Animator_hpp */
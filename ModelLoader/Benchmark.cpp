@@ -0,0 +1,220 @@
+//
+//  Benchmark.cpp
+//  ModelLoader
+//
+//  Created by Apple on 19/10/26.
+//
+
+#include "Benchmark.hpp"
+
+void Benchmark::RunAll(){
+    RunSkinningBenchmark();
+    RunMotionMatchingBenchmark();
+    RunLargeRigCheck();
+}
+
+void Benchmark::RunSkinningBenchmark(size_t vertexCount, int boneCount){
+    std::mt19937 random(1406);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+    
+    // Random affine palette
+    std::vector<glm::mat4> palette(boneCount, glm::mat4(1.0f));
+    for(int bone=0; bone<boneCount; bone++){
+        for(int column=0; column<4; column++){
+            for(int row=0; row<3; row++){
+                palette[bone][column][row] = unit(random);
+            }
+        }
+    }
+    
+    // Random vertices with 1 to 4 normalised influences
+    std::vector<Vertex> vertices(vertexCount);
+    for(size_t v=0; v<vertexCount; v++){
+        Vertex &vertex = vertices[v];
+        vertex.position = glm::vec3(unit(random), unit(random), unit(random)) * 10.0f;
+        vertex.normal = glm::normalize(glm::vec3(unit(random), unit(random), unit(random)));
+        vertex.texCoords = glm::vec2(0.0f, 0.0f);
+        
+        int influences = 1 + (int)(random() % MAX_BONE_INFLUENCE);
+        float totalWeight = 0.0f;
+        for(int i=0; i<MAX_BONE_INFLUENCE; i++){
+            vertex.mBoneIds[i] = i < influences ? (int)(random() % boneCount) : -1;
+            vertex.mWeights[i] = i < influences ? unit(random) + 1.001f : 0.0f;
+            totalWeight += vertex.mWeights[i];
+        }
+        for(int i=0; i<MAX_BONE_INFLUENCE; i++){
+            vertex.mWeights[i] /= totalWeight;
+        }
+    }
+    
+    ThreadPool pool;
+    std::vector<SkinnedVertex> reference, skinned;
+    CpuSkinning::Skin(vertices, palette, reference, nullptr, SKINNING_KERNEL_SCALAR);
+    
+    printf("CPU skinning, %zu vertices, %d bones, %u worker threads\n", vertexCount, boneCount, pool.GetThreadCount());
+    printf("%-8s %-8s %10s %12s %10s %12s\n", "Kernel", "Threads", "ms", "Mverts/s", "Speedup", "Max error");
+    
+    double scalarTime = 0.0;
+    SkinningKernel kernels[] = { SKINNING_KERNEL_SCALAR, SKINNING_KERNEL_SSE, SKINNING_KERNEL_AVX2 };
+    for(SkinningKernel kernel : kernels){
+        // Don't report a kernel the CPU would silently fall back from
+        if(kernel > CpuSkinning::GetBestKernel()){
+            continue;
+        }
+        
+        for(int threaded=0; threaded<2; threaded++){
+            ThreadPool *kernelPool = threaded ? &pool : nullptr;
+            double time = TimeBest(5, [&](){
+                CpuSkinning::Skin(vertices, palette, skinned, kernelPool, kernel);
+            });
+            if(kernel == SKINNING_KERNEL_SCALAR && !threaded){
+                scalarTime = time;
+            }
+            
+            float maxError = 0.0f;
+            for(size_t v=0; v<vertexCount; v++){
+                maxError = std::max(maxError, glm::length(skinned[v].position - reference[v].position));
+                maxError = std::max(maxError, glm::length(skinned[v].normal - reference[v].normal));
+            }
+            
+            printf("%-8s %-8s %10.3f %12.1f %9.2fx %12.2e\n",
+                   CpuSkinning::GetKernelName(kernel),
+                   threaded ? "pool" : "1",
+                   time,
+                   vertexCount / (time * 1000.0),
+                   scalarTime / time,
+                   maxError);
+        }
+    }
+}
+
+void Benchmark::RunMotionMatchingBenchmark(int featureCount, int queryCount){
+    printf("\nMotion matching, %d features, %d queries\n", featureCount, queryCount);
+    printf("%-8s %12s %12s %12s %10s %10s\n", "Frames", "Build ms", "KD us", "Brute us", "Speedup", "Mismatch");
+    
+    int frameCounts[] = { 1000, 10000, 50000, 100000 };
+    for(int frameCount : frameCounts){
+        std::mt19937 random(1406);
+        std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+        
+        // Clips of 300 frames, each feature a sum of two sines of the clip's phase
+        std::vector<float> frequencies(featureCount * 2), phases(featureCount * 2);
+        for(int i=0; i<featureCount * 2; i++){
+            frequencies[i] = 1.0f + 2.0f * (unit(random) + 1.0f);
+            phases[i] = 3.14159f * unit(random);
+        }
+        std::vector<float> clipGain(frameCount / 300 + 1);
+        for(float &gain : clipGain){
+            gain = 1.0f + 0.5f * unit(random);
+        }
+        auto sampleFeatures = [&](int clip, float phase, float *features){
+            for(int i=0; i<featureCount; i++){
+                features[i] = clipGain[clip] * std::sin(frequencies[2 * i] * phase + phases[2 * i])
+                            + 0.5f * std::sin(frequencies[2 * i + 1] * phase * clipGain[clip] + phases[2 * i + 1]);
+            }
+        };
+        
+        MotionDatabase database(std::vector<int>(featureCount, 0));
+        std::vector<float> features(featureCount);
+        for(int frame=0; frame<frameCount; frame++){
+            int clip = frame / 300;
+            float time = (float)(frame % 300);
+            sampleFeatures(clip, time / 60.0f, &features[0]);
+            database.AddFrame(clip, time, &features[0]);
+        }
+        double buildTime = TimeBest(1, [&](){ database.Build(); });
+        
+        // Queries between frames with some noise, like a character slightly off any clip
+        std::vector<float> queries(queryCount * database.GetStride());
+        for(int q=0; q<queryCount; q++){
+            int clip = (int)(random() % clipGain.size());
+            sampleFeatures(clip, (float)(random() % 300) / 60.0f + 0.5f / 60.0f, &features[0]);
+            for(int i=0; i<featureCount; i++){
+                features[i] += 0.05f * unit(random);
+            }
+            database.NormalizeQuery(&features[0], &queries[q * database.GetStride()]);
+        }
+        
+        std::vector<MotionMatch> treeMatches(queryCount), bruteMatches(queryCount);
+        double treeTime = TimeBest(3, [&](){
+            for(int q=0; q<queryCount; q++){
+                treeMatches[q] = database.FindNearest(&queries[q * database.GetStride()]);
+            }
+        });
+        double bruteTime = TimeBest(3, [&](){
+            for(int q=0; q<queryCount; q++){
+                bruteMatches[q] = database.FindNearestBruteForce(&queries[q * database.GetStride()]);
+            }
+        });
+        
+        // Both are exact, only ties at equal cost may pick different frames
+        int mismatches = 0;
+        for(int q=0; q<queryCount; q++){
+            if(treeMatches[q].cost != bruteMatches[q].cost){
+                mismatches++;
+            }
+        }
+        
+        printf("%-8d %12.2f %12.2f %12.2f %9.2fx %10d\n",
+               frameCount,
+               buildTime,
+               treeTime * 1000.0 / queryCount,
+               bruteTime * 1000.0 / queryCount,
+               bruteTime / treeTime,
+               mismatches);
+    }
+}
+
+void Benchmark::RunLargeRigCheck(int boneCount, int meshCount){
+    printf("\nLarge rig, %d bones over %d meshes\n", boneCount, meshCount);
+    
+    // Each node one unit above its parent with an identity offset, so bone i ends at y = i + 1
+    std::shared_ptr<Skeleton> skeleton = std::make_shared<Skeleton>();
+    for(int i=0; i<boneCount; i++){
+        std::string name = "bone" + std::to_string(i);
+        skeleton->AddNode(name, i - 1, glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 1.0f, 0.0f)));
+        skeleton->AddBone(name, glm::mat4(1.0f));
+    }
+    skeleton->Finalize();
+    
+    Animation restPose(skeleton);
+    Animator animator(&restPose);
+    animator.SetAnimationTime(0.0f);
+    const std::vector<glm::mat4> &palette = animator.GetFinalBoneMatrices();
+    
+    // Consecutive slices of at most MAX_PALETTE_BONES, one triangle each
+    int mismatches = 0;
+    int sliceSize = (boneCount + meshCount - 1) / meshCount;
+    for(int m=0; m<meshCount; m++){
+        std::vector<int> paletteBones;
+        for(int bone=m * sliceSize; bone<std::min(boneCount, (m + 1) * sliceSize); bone++){
+            paletteBones.push_back(bone);
+        }
+        assert(paletteBones.size() <= MAX_PALETTE_BONES);
+        
+        std::vector<Vertex> vertices(3);
+        for(Vertex &vertex : vertices){
+            vertex.position = glm::vec3(0.0f);
+            vertex.normal = glm::vec3(0.0f, 1.0f, 0.0f);
+            vertex.texCoords = glm::vec2(0.0f);
+            for(int i=0; i<MAX_BONE_INFLUENCE; i++){
+                vertex.mBoneIds[i] = -1;
+                vertex.mWeights[i] = 0.0f;
+            }
+            vertex.mBoneIds[0] = 0;
+            vertex.mWeights[0] = 1.0f;
+        }
+        Mesh mesh(vertices, std::vector<unsigned int>{ 0, 1, 2 }, std::vector<Texture>(), false, paletteBones);
+        
+        std::vector<glm::mat4> meshPalette;
+        mesh.gatherPalette(palette, meshPalette);
+        for(size_t slot=0; slot<paletteBones.size(); slot++){
+            if(meshPalette[slot][3].y != (float)(paletteBones[slot] + 1)){
+                mismatches++;
+            }
+        }
+    }
+    
+    printf("Palette size %zu, %d mismatched slots: %s\n", palette.size(), mismatches,
+           palette.size() == (size_t)boneCount && mismatches == 0 ? "OK" : "FAILED");
+}
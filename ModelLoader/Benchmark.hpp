@@ -0,0 +1,55 @@
+//
+//  Benchmark.hpp
+//  ModelLoader
+//
+//  Created by Apple on 19/10/26.
+//
+
+#ifndef Benchmark_hpp
+#define Benchmark_hpp
+
+#include <stdio.h>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <algorithm>
+
+#include "CpuSkinning.hpp"
+#include "MotionDatabase.hpp"
+#include "Animator.hpp"
+
+/* Micro benchmarks run from the command line with --benchmark. They work on synthetic
+    data so neither a GL context nor the model files are needed */
+class Benchmark{
+public:
+    static void RunAll();
+    
+    /* Times every CPU skinning kernel against the scalar reference, single threaded and
+        on a thread pool, and checks they agree */
+    static void RunSkinningBenchmark(size_t vertexCount = 1000000, int boneCount = 100);
+    
+    /* Query latency of the motion matching database, KD-tree against brute force, for
+        growing numbers of frames. The features follow smooth synthetic clips so they lie
+        on a low dimensional manifold like real motion does */
+    static void RunMotionMatchingBenchmark(int featureCount = 27, int queryCount = 1000);
+    
+    /* Not a timing: poses a chain rig of boneCount bones skinned by meshCount meshes, each
+        with its own slice of the bones, and checks every mesh gathers the matrices of its
+        own bones from the Animator's palette */
+    static void RunLargeRigCheck(int boneCount = 250, int meshCount = 3);
+    
+private:
+    /* Best wall time of a few runs, in milliseconds */
+    template<typename Function>
+    static double TimeBest(int runs, Function function){
+        double best = 1e30;
+        for(int i=0; i<runs; i++){
+            auto start = std::chrono::high_resolution_clock::now();
+            function();
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+            best = std::min(best, elapsed.count());
+        }
+        return best;
+    }
+};
+#endif /* Benchmark_hpp */
@@ -19,73 +19,186 @@
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 #include <vector>
+#include <cmath>
+#include <algorithm>
+#include <cassert>
 
 #include "assimp_glm_helper.h"
 
-struct KeyPosition{
-    glm::vec3 position;
-    float timestamp;
+/* How a track's keys are sampled, picked once at load from the keys themselves */
+enum TrackType{
+    TRACK_CONSTANT,     // One key, or every key holds the same value
+    TRACK_STEP,         // Values only hold or jump, no key needs interpolating
+    TRACK_LINEAR,       // Irregular key times, searched from the cursor then interpolated
+    TRACK_UNIFORM,      // Evenly spaced keys, the key index is computed from the time
+    TRACK_TYPE_COUNT
 };
 
-struct KeyRotation{
-    glm::quat orientation;
-    float timestamp;
+/* Keyframes of one component of a bone, times and values stored apart. The keys are not
+    owned: they live in the clip's ClipFile, imported or mapped from the cache */
+template<typename T>
+struct Track{
+    const float *times = nullptr;
+    const T *values = nullptr;
+    int keyCount = 0;
+    TrackType type = TRACK_CONSTANT;
+    float inverseInterval = 0.0f;   // Keys per tick, TRACK_UNIFORM only
 };
 
-struct KeyScale{
-    glm::vec3 scale;
-    float timestamp;
+/* Last key index used on each track of a bone. Owned by the Animator so that the key
+    search can resume where the previous frame left off without writing into the Bone */
+struct BoneCursor{
+    int position = 0;
+    int rotation = 0;
+    int scale = 0;
 };
 
 class Bone{
 public:
-    // Read Keyframes from aiNodeAnim
-    Bone(const std::string &name, int id, const aiNodeAnim *channel);
+    /* Views over keyframes owned by the clip's ClipFile */
+    Bone(const std::string &name, int id, const Track<glm::vec3> &positions, const Track<glm::quat> &rotations, const Track<glm::vec3> &scales);
     /* Interpolates b/w positions,rotations & scaling keys based on the curren time of the
-        animation and prepares the local transformation matrix by combining all keys tranformations */
-    void Update(float animationTime);
+        animation and returns the local transformation matrix by combining all keys tranformations.
+        The bone itself is never modified, the key search state lives in the caller's cursor */
+    glm::mat4 Sample(float animationTime, BoneCursor &cursor) const;
     
-    glm::mat4 GetLocalTransform() { return mLocalTransform; }
-    std::string GetBoneName() const { return mName; }
-    int GetBoneID() { return mId; }
+    /* Same as Sample but keeps the components apart, for poses that are blended before
+        the hierarchy is solved */
+    void SampleLocal(float animationTime, BoneCursor &cursor, glm::vec3 &position, glm::quat &rotation, glm::vec3 &scale) const;
+    
+    const std::string& GetBoneName() const { return mName; }
+    int GetBoneID() const { return mId; }
+    
+    const Track<glm::vec3>& GetPositionTrack() const { return mPositions; }
+    const Track<glm::quat>& GetRotationTrack() const { return mRotations; }
+    const Track<glm::vec3>& GetScaleTrack() const { return mScales; }
     
     /* Gets the current index on mKeyPositions to interpolate to based on the current
-        animation time */
-    int GetPositionIndex(float animationTime);
+        animation time, starting the search from the hinted index */
+    int GetPositionIndex(float animationTime, int hint = 0) const;
     
     /* Gets the current index on mKeyRotations to interpolate to based on the current
-        animation time */
-    int GetRotationIndex(float animationTime);
+        animation time, starting the search from the hinted index */
+    int GetRotationIndex(float animationTime, int hint = 0) const;
     
     /* Gets the current index on mKeyScalings to interpolate to based on the current
-        animation time */
-    int GetScaleIndex(float animationTime);
+        animation time, starting the search from the hinted index */
+    int GetScaleIndex(float animationTime, int hint = 0) const;
 private:
-    std::vector<KeyPosition> mPositions;
-    std::vector<KeyRotation> mRotations;
-    std::vector<KeyScale> mScales;
-    int mNumPositions;
-    int mNumRotations;
-    int mNumScalings;
+    Track<glm::vec3> mPositions;
+    Track<glm::quat> mRotations;
+    Track<glm::vec3> mScales;
     
-    glm::mat4 mLocalTransform;
     std::string mName;
     int mId;
+};
+
+// -- Track sampling
+
+/* Sets the track's type from its keys */
+template<typename T>
+void ClassifyTrack(Track<T> &track){
+    int keyCount = track.keyCount;
+    bool holdsOnly = true;
+    bool stepsOnly = true;
+    bool uniform = true;
     
-    // Functions
-    /* Gets normalized value for Lerp & Slerp*/
-    float GetScaleFactor(float lastTimeStamp, float nextTimeStamp, float animationTime);
-    
-    /* figures out which position keys to interpolate b/w and performs the interpolation
-        and returns the translation matrix */
-    glm::mat4 InterpolatePosition(float animationTime);
-    
-    /* figures out which rotations keys to interpolate b/w and performs the interpolation
-        and returns the rotation matrix */
-    glm::mat4 InterpolateRotation(float animationTime);
+    float span = keyCount > 1 ? track.times[keyCount - 1] - track.times[0] : 0.0f;
+    float interval = keyCount > 1 ? span / (keyCount - 1) : 0.0f;
+    float timeEpsilon = interval * 1e-3f;
+    for(int i=0; i+1<keyCount; i++){
+        float gap = track.times[i + 1] - track.times[i];
+        bool hold = track.values[i] == track.values[i + 1];
+        holdsOnly = holdsOnly && hold;
+        stepsOnly = stepsOnly && (hold || gap <= timeEpsilon);      // Exporters bake a step as two keys at the same time
+        // Against the key's ideal time rather than the previous key, so gap errors can't add up
+        uniform = uniform && fabsf(track.times[i + 1] - (track.times[0] + (i + 1) * interval)) <= timeEpsilon;
+    }
     
-    /* figures out which scaling keys to interpolate b/w and performs the interpolation
-        and returns the scale matrix */
-    glm::mat4 InterpolateScaling(float animationTime);
+    if(keyCount <= 1 || holdsOnly){
+        track.type = TRACK_CONSTANT;
+    }else if(stepsOnly){
+        track.type = TRACK_STEP;
+    }else if(uniform && interval > 0.0f){
+        track.type = TRACK_UNIFORM;
+        track.inverseInterval = 1.0f / interval;
+    }else{
+        track.type = TRACK_LINEAR;
+    }
+}
+
+inline glm::vec3 InterpolateKeys(const glm::vec3 &from, const glm::vec3 &to, float factor){
+    return glm::mix(from, to, factor);
+}
+
+inline glm::quat InterpolateKeys(const glm::quat &from, const glm::quat &to, float factor){
+    return glm::normalize(glm::slerp(from, to, factor));
+}
+
+/* Index of the key at or before animationTime, clamped to the second last key. Resumes
+    from the hinted index unless the animation looped or jumped backwards */
+template<typename T>
+int FindKey(const Track<T> &track, float animationTime, int hint){
+    int lastSegment = track.keyCount - 2;
+    if(hint < 0 || hint > lastSegment || animationTime < track.times[hint]){
+        hint = 0;
+    }
+    while(hint < lastSegment && animationTime >= track.times[hint + 1]){
+        hint++;
+    }
+    return hint;
+}
+
+/* One sampler per track type, so the hot loops over a batch of tracks of the same type
+    have no per key branching */
+template<TrackType TYPE>
+struct TrackSampler;
+
+template<>
+struct TrackSampler<TRACK_CONSTANT>{
+    template<typename T>
+    static T Sample(const Track<T> &track, float /*animationTime*/, int &/*cursor*/){
+        return track.values[0];
+    }
 };
+
+template<>
+struct TrackSampler<TRACK_STEP>{
+    template<typename T>
+    static T Sample(const Track<T> &track, float animationTime, int &cursor){
+        cursor = FindKey(track, animationTime, cursor);
+        return animationTime >= track.times[cursor + 1] ? track.values[cursor + 1] : track.values[cursor];
+    }
+};
+
+template<>
+struct TrackSampler<TRACK_LINEAR>{
+    template<typename T>
+    static T Sample(const Track<T> &track, float animationTime, int &cursor){
+        cursor = FindKey(track, animationTime, cursor);
+        float factor = (animationTime - track.times[cursor]) / (track.times[cursor + 1] - track.times[cursor]);
+        return InterpolateKeys(track.values[cursor], track.values[cursor + 1], std::max(0.0f, std::min(factor, 1.0f)));
+    }
+};
+
+template<>
+struct TrackSampler<TRACK_UNIFORM>{
+    template<typename T>
+    static T Sample(const Track<T> &track, float animationTime, int &/*cursor*/){
+        float keyTime = std::max(0.0f, (animationTime - track.times[0]) * track.inverseInterval);
+        int key = std::min((int)keyTime, track.keyCount - 2);
+        return InterpolateKeys(track.values[key], track.values[key + 1], std::min(keyTime - key, 1.0f));
+    }
+};
+
+/* Picks the sampler for a single track, for callers that don't batch by type */
+template<typename T>
+T SampleTrack(const Track<T> &track, float animationTime, int &cursor){
+    switch(track.type){
+        case TRACK_STEP:    return TrackSampler<TRACK_STEP>::Sample(track, animationTime, cursor);
+        case TRACK_LINEAR:  return TrackSampler<TRACK_LINEAR>::Sample(track, animationTime, cursor);
+        case TRACK_UNIFORM: return TrackSampler<TRACK_UNIFORM>::Sample(track, animationTime, cursor);
+        default:            return TrackSampler<TRACK_CONSTANT>::Sample(track, animationTime, cursor);
+    }
+}
 #endif /* Bone_hpp */
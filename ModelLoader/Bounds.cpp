@@ -0,0 +1,47 @@
+//
+//  Bounds.cpp
+//  ModelLoader
+//
+//  Created by Apple on 19/10/26.
+//
+
+#include "Bounds.hpp"
+
+void AABB::Expand(const glm::vec3 &point){
+    min = glm::min(min, point);
+    max = glm::max(max, point);
+}
+
+void AABB::Merge(const AABB &other){
+    if(other.IsEmpty()){
+        return;
+    }
+    min = glm::min(min, other.min);
+    max = glm::max(max, other.max);
+}
+
+AABB AABB::Transformed(const glm::mat4 &matrix) const{
+    AABB box;
+    if(IsEmpty()){
+        return box;
+    }
+    
+    // Each half extent axis maps to a column, their absolute values add up to the new extents
+    glm::vec3 center = glm::vec3(matrix * glm::vec4(GetCenter(), 1.0f));
+    glm::vec3 halfExtents = (max - min) * 0.5f;
+    glm::vec3 newHalfExtents = glm::abs(glm::vec3(matrix[0])) * halfExtents.x
+                             + glm::abs(glm::vec3(matrix[1])) * halfExtents.y
+                             + glm::abs(glm::vec3(matrix[2])) * halfExtents.z;
+    box.min = center - newHalfExtents;
+    box.max = center + newHalfExtents;
+    return box;
+}
+
+AABB SkinnedBounds::Compute(const std::vector<AABB> &boneBounds, const std::vector<glm::mat4> &palette){
+    AABB bounds;
+    size_t boneCount = std::min(boneBounds.size(), palette.size());
+    for(size_t i=0; i<boneCount; i++){
+        bounds.Merge(boneBounds[i].Transformed(palette[i]));
+    }
+    return bounds;
+}
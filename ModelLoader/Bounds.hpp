@@ -0,0 +1,42 @@
+//
+//  Bounds.hpp
+//  ModelLoader
+//
+//  Created by Apple on 19/10/26.
+//
+
+#ifndef Bounds_hpp
+#define Bounds_hpp
+
+#include <stdio.h>
+#include <vector>
+#include <cfloat>
+#include <algorithm>
+#include <glm/glm.hpp>
+
+/* Axis aligned bounding box, empty until a point is added */
+struct AABB{
+    glm::vec3 min = glm::vec3(FLT_MAX);
+    glm::vec3 max = glm::vec3(-FLT_MAX);
+    
+    bool IsEmpty() const { return min.x > max.x; }
+    void Expand(const glm::vec3 &point);
+    void Merge(const AABB &other);
+    
+    /* Box around this box once transformed by matrix, exact for affine transforms of the
+        8 corners but computed from the center and half extents */
+    AABB Transformed(const glm::mat4 &matrix) const;
+    
+    glm::vec3 GetCenter() const { return (min + max) * 0.5f; }
+    /* Radius of the sphere around the box, for the sphere based tests of AnimationLOD */
+    float GetRadius() const { return glm::length(max - min) * 0.5f; }
+};
+
+/* Bounds of a skinned mesh without skinning its vertices */
+class SkinnedBounds{
+public:
+    /* Union of each bone's bind pose box moved by that bone's palette matrix. Bones
+        with an empty box, bound to no vertex, are skipped */
+    static AABB Compute(const std::vector<AABB> &boneBounds, const std::vector<glm::mat4> &palette);
+};
+#endif /* Bounds_hpp */
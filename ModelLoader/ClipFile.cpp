@@ -0,0 +1,212 @@
+//
+//  ClipFile.cpp
+//  ModelLoader
+//
+//  Created by Apple on 19/10/26.
+//
+
+#include "ClipFile.hpp"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* Appends count values at the next aligned offset of buffer and returns that offset */
+template<typename T>
+static uint64_t AppendArray(std::vector<char> &buffer, const T *values, size_t count){
+    size_t offset = (buffer.size() + CLIP_FILE_ALIGNMENT - 1) & ~(size_t)(CLIP_FILE_ALIGNMENT - 1);
+    buffer.resize(offset + count * sizeof(T));
+    if(count > 0){
+        memcpy(&buffer[offset], values, count * sizeof(T));
+    }
+    return offset;
+}
+
+/* Appends the keys of an aiVectorKey or aiQuatKey array, times then values */
+template<typename T, typename Key, typename Convert>
+static ClipFileTrack AppendTrack(std::vector<char> &buffer, const Key *keys, unsigned int keyCount, Convert convert){
+    std::vector<float> times(keyCount);
+    std::vector<T> values(keyCount);
+    for(unsigned int i=0; i<keyCount; i++){
+        times[i] = (float)keys[i].mTime;
+        values[i] = convert(keys[i].mValue);
+    }
+    
+    ClipFileTrack track = ClipFileTrack();
+    track.timesOffset = AppendArray(buffer, times.data(), keyCount);
+    track.valuesOffset = AppendArray(buffer, values.data(), keyCount);
+    track.keyCount = keyCount;
+    return track;
+}
+
+/* Classifies a track once the buffer won't move anymore */
+template<typename T>
+static void ClassifyFileTrack(const char *data, ClipFileTrack &fileTrack){
+    Track<T> track;
+    track.times = (const float*)(data + fileTrack.timesOffset);
+    track.values = (const T*)(data + fileTrack.valuesOffset);
+    track.keyCount = (int)fileTrack.keyCount;
+    ClassifyTrack(track);
+    fileTrack.type = (uint32_t)track.type;
+    fileTrack.inverseInterval = track.inverseInterval;
+}
+
+ClipFile::ClipFile(){
+    
+}
+
+ClipFile::~ClipFile(){
+    if(mMapping){
+        munmap(mMapping, mSize);
+    }
+}
+
+std::shared_ptr<ClipFile> ClipFile::Import(const aiAnimation *animation, const Skeleton &skeleton, const std::string &sourcePath){
+    std::shared_ptr<ClipFile> clip(new ClipFile());
+    std::vector<char> &buffer = clip->mBuffer;
+    
+    ClipFileHeader header = ClipFileHeader();
+    header.magic = CLIP_FILE_MAGIC;
+    header.version = CLIP_FILE_VERSION;
+    header.skeletonLayoutHash = skeleton.GetLayoutHash();
+    GetSourceStamp(sourcePath, header.sourceSize, header.sourceTime);
+    header.duration = (float)animation->mDuration;
+    header.ticksPerSecond = (float)animation->mTicksPerSecond;
+    buffer.resize(sizeof(ClipFileHeader));
+    
+    std::vector<ClipFileChannel> channels;
+    for(unsigned int i=0; i<animation->mNumChannels; i++){
+        const aiNodeAnim *nodeAnim = animation->mChannels[i];
+        int node = skeleton.FindNode(nodeAnim->mNodeName.C_Str());
+        if(node < 0){
+            LOGGER("Skipping channel "+std::string(nodeAnim->mNodeName.C_Str())+", no such node in the skeleton");
+            continue;
+        }
+        
+        ClipFileChannel channel = ClipFileChannel();
+        channel.nameOffset = (uint32_t)AppendArray(buffer, nodeAnim->mNodeName.C_Str(), nodeAnim->mNodeName.length + 1);
+        channel.node = node;
+        channel.boneId = skeleton.FindBone(nodeAnim->mNodeName.C_Str());
+        channel.positions = AppendTrack<glm::vec3>(buffer, nodeAnim->mPositionKeys, nodeAnim->mNumPositionKeys, [](const aiVector3D &value){
+            return AssimpGLMHelpers::GetGLMVec(value);
+        });
+        channel.rotations = AppendTrack<glm::quat>(buffer, nodeAnim->mRotationKeys, nodeAnim->mNumRotationKeys, [](const aiQuaternion &value){
+            return glm::normalize(AssimpGLMHelpers::GetGLMQuat(value));
+        });
+        channel.scales = AppendTrack<glm::vec3>(buffer, nodeAnim->mScalingKeys, nodeAnim->mNumScalingKeys, [](const aiVector3D &value){
+            return AssimpGLMHelpers::GetGLMVec(value);
+        });
+        channels.push_back(channel);
+    }
+    
+    for(ClipFileChannel &channel : channels){
+        ClassifyFileTrack<glm::vec3>(buffer.data(), channel.positions);
+        ClassifyFileTrack<glm::quat>(buffer.data(), channel.rotations);
+        ClassifyFileTrack<glm::vec3>(buffer.data(), channel.scales);
+    }
+    header.channelCount = (uint32_t)channels.size();
+    header.channelsOffset = AppendArray(buffer, channels.data(), channels.size());
+    header.fileSize = buffer.size();
+    memcpy(buffer.data(), &header, sizeof(header));
+    
+    clip->mData = buffer.data();
+    clip->mSize = buffer.size();
+    return clip;
+}
+
+std::shared_ptr<ClipFile> ClipFile::Open(const std::string &path, const Skeleton &skeleton, const std::string &sourcePath){
+    int64_t sourceSize = 0, sourceTime = 0;
+    if(!GetSourceStamp(sourcePath, sourceSize, sourceTime)){
+        return nullptr;
+    }
+    
+    int file = open(path.c_str(), O_RDONLY);
+    if(file < 0){
+        return nullptr;
+    }
+    struct stat status;
+    if(fstat(file, &status) != 0 || (size_t)status.st_size < sizeof(ClipFileHeader)){
+        close(file);
+        return nullptr;
+    }
+    
+    // The mapping stays valid once the descriptor is closed
+    void *mapping = mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if(mapping == MAP_FAILED){
+        return nullptr;
+    }
+    
+    std::shared_ptr<ClipFile> clip(new ClipFile());
+    clip->mMapping = mapping;
+    clip->mData = (const char*)mapping;
+    clip->mSize = (size_t)status.st_size;
+    if(!clip->Validate(skeleton, sourceSize, sourceTime)){
+        LOGGER("Ignoring stale clip cache "+path);
+        return nullptr;
+    }
+    return clip;
+}
+
+bool ClipFile::Write(const std::string &path) const{
+    std::string temporaryPath = path + ".tmp";
+    FILE *file = fopen(temporaryPath.c_str(), "wb");
+    if(!file){
+        LOGGER("Unable to write clip cache "+path);
+        return false;
+    }
+    bool written = fwrite(mData, 1, mSize, file) == mSize;
+    written = fclose(file) == 0 && written;
+    if(!written || rename(temporaryPath.c_str(), path.c_str()) != 0){
+        remove(temporaryPath.c_str());
+        LOGGER("Unable to write clip cache "+path);
+        return false;
+    }
+    return true;
+}
+
+bool ClipFile::GetSourceStamp(const std::string &sourcePath, int64_t &size, int64_t &time){
+    struct stat status;
+    if(stat(sourcePath.c_str(), &status) != 0){
+        size = 0;
+        time = 0;
+        return false;
+    }
+    size = (int64_t)status.st_size;
+    time = (int64_t)status.st_mtime;
+    return true;
+}
+
+template<typename T>
+bool ClipFile::ValidateTrack(const ClipFileTrack &fileTrack) const{
+    return fileTrack.type < TRACK_TYPE_COUNT
+        && fileTrack.timesOffset % CLIP_FILE_ALIGNMENT == 0
+        && fileTrack.valuesOffset % CLIP_FILE_ALIGNMENT == 0
+        && fileTrack.timesOffset + (uint64_t)fileTrack.keyCount * sizeof(float) <= mSize
+        && fileTrack.valuesOffset + (uint64_t)fileTrack.keyCount * sizeof(T) <= mSize;
+}
+
+bool ClipFile::Validate(const Skeleton &skeleton, int64_t sourceSize, int64_t sourceTime) const{
+    const ClipFileHeader &header = GetHeader();
+    if(header.magic != CLIP_FILE_MAGIC || header.version != CLIP_FILE_VERSION || header.fileSize != mSize
+       || header.skeletonLayoutHash != skeleton.GetLayoutHash()
+       || header.sourceSize != sourceSize || header.sourceTime != sourceTime
+       || header.channelsOffset % CLIP_FILE_ALIGNMENT != 0
+       || header.channelsOffset + (uint64_t)header.channelCount * sizeof(ClipFileChannel) > mSize){
+        return false;
+    }
+    
+    // Offsets are only checked to stay in the file, a few compares per channel
+    int nodeCount = (int)skeleton.GetNodes().size();
+    for(uint32_t i=0; i<header.channelCount; i++){
+        const ClipFileChannel &channel = GetChannel(i);
+        if(channel.node < 0 || channel.node >= nodeCount || channel.nameOffset >= mSize
+           || !ValidateTrack<glm::vec3>(channel.positions)
+           || !ValidateTrack<glm::quat>(channel.rotations)
+           || !ValidateTrack<glm::vec3>(channel.scales)){
+            return false;
+        }
+    }
+    return true;
+}
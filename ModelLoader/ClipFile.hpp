@@ -0,0 +1,115 @@
+//
+//  ClipFile.hpp
+//  ModelLoader
+//
+//  Created by Apple on 19/10/26.
+//
+
+#ifndef ClipFile_hpp
+#define ClipFile_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstring>
+#include <assimp/scene.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "Bone.hpp"
+#include "Skeleton.hpp"
+#include "Logger.h"
+
+#define CLIP_FILE_MAGIC 0x50494C43u         // "CLIP"
+#define CLIP_FILE_VERSION 1
+#define CLIP_FILE_ALIGNMENT 16              // Of every array in the file
+#define CLIP_FILE_EXTENSION ".clip"         // Appended to the path of the imported file
+
+/* Keys of one track, offsets are in bytes from the start of the file */
+struct ClipFileTrack{
+    uint64_t timesOffset;
+    uint64_t valuesOffset;
+    uint32_t keyCount;
+    uint32_t type;                          // TrackType
+    float inverseInterval;
+    uint32_t padding;
+};
+
+/* One channel, already bound to the skeleton node it drives */
+struct ClipFileChannel{
+    uint32_t nameOffset;                    // Null terminated
+    int32_t node;
+    int32_t boneId;
+    uint32_t padding;
+    ClipFileTrack positions;                // glm::vec3 values
+    ClipFileTrack rotations;                // glm::quat values
+    ClipFileTrack scales;                   // glm::vec3 values
+};
+
+struct ClipFileHeader{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t skeletonLayoutHash;            // Skeleton::GetLayoutHash of the skeleton it was bound to
+    uint32_t channelCount;
+    int64_t sourceSize;                     // Size and modification time of the imported file,
+    int64_t sourceTime;                     // a cache older than its source is stale
+    float duration;
+    float ticksPerSecond;
+    uint64_t fileSize;
+    uint64_t channelsOffset;                // channelCount ClipFileChannel
+};
+
+/* Keyframes of a clip in one contiguous block laid out exactly like the .clip cache, so a
+    cached clip loads by mapping the file and turning offsets into pointers, with no per
+    key parsing. An imported clip is built into the same layout in memory, then written
+    next to its source for the next run. Bones keep pointers into it, so it must outlive
+    the Animation's bones */
+class ClipFile{
+public:
+    ~ClipFile();
+    
+    /* Converts the channels of animation that drive a node of skeleton */
+    static std::shared_ptr<ClipFile> Import(const aiAnimation *animation, const Skeleton &skeleton, const std::string &sourcePath);
+    /* Maps the cache at path, nullptr if there is none or it doesn't match the source file,
+        the skeleton or this version */
+    static std::shared_ptr<ClipFile> Open(const std::string &path, const Skeleton &skeleton, const std::string &sourcePath);
+    /* Writes through a temporary file renamed into place, so readers never see half a file */
+    bool Write(const std::string &path) const;
+    
+    // -- Getters
+    const ClipFileHeader& GetHeader() const { return *(const ClipFileHeader*)mData; }
+    const ClipFileChannel& GetChannel(int channel) const
+        {
+            return ((const ClipFileChannel*)(mData + GetHeader().channelsOffset))[channel];
+        }
+    const char* GetName(const ClipFileChannel &channel) const { return mData + channel.nameOffset; }
+    
+    /* Pointer fixup of a track's offsets */
+    template<typename T>
+    Track<T> GetTrack(const ClipFileTrack &fileTrack) const{
+        Track<T> track;
+        track.times = (const float*)(mData + fileTrack.timesOffset);
+        track.values = (const T*)(mData + fileTrack.valuesOffset);
+        track.keyCount = (int)fileTrack.keyCount;
+        track.type = (TrackType)fileTrack.type;
+        track.inverseInterval = fileTrack.inverseInterval;
+        return track;
+    }
+    
+private:
+    // Properties
+    const char *mData = nullptr;
+    size_t mSize = 0;
+    std::vector<char> mBuffer;              // Imported clips
+    void *mMapping = nullptr;               // Mapped cache files
+    
+    // Functions
+    ClipFile();
+    static bool GetSourceStamp(const std::string &sourcePath, int64_t &size, int64_t &time);
+    bool Validate(const Skeleton &skeleton, int64_t sourceSize, int64_t sourceTime) const;
+    template<typename T>
+    bool ValidateTrack(const ClipFileTrack &fileTrack) const;
+};
+#endif /* ClipFile_hpp */
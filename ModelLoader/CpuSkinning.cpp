@@ -0,0 +1,210 @@
+//
+//  CpuSkinning.cpp
+//  ModelLoader
+//
+//  Created by Apple on 19/10/26.
+//
+
+#include "CpuSkinning.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_SKINNING_X86 1
+#include <immintrin.h>
+#endif
+
+// Vertices per task, large enough to amortise the queue and keep writes on separate cache lines
+static const size_t SKINNING_GRAIN_SIZE = 4096;
+
+SkinningKernel CpuSkinning::GetBestKernel(){
+#ifdef CPU_SKINNING_X86
+    // Cached, the answer can't change while running
+    static const SkinningKernel best = (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+                                        ? SKINNING_KERNEL_AVX2 : SKINNING_KERNEL_SSE;
+    return best;
+#else
+    return SKINNING_KERNEL_SCALAR;
+#endif
+}
+
+const char* CpuSkinning::GetKernelName(SkinningKernel kernel){
+    switch(kernel){
+        case SKINNING_KERNEL_SSE: return "SSE";
+        case SKINNING_KERNEL_AVX2: return "AVX2";
+        default: return "Scalar";
+    }
+}
+
+void CpuSkinning::Skin(const std::vector<Vertex> &vertices, const std::vector<glm::mat4> &palette,
+                       std::vector<SkinnedVertex> &skinned, ThreadPool *pool){
+    Skin(vertices, palette, skinned, pool, GetBestKernel());
+}
+
+void CpuSkinning::Skin(const std::vector<Vertex> &vertices, const std::vector<glm::mat4> &palette,
+                       std::vector<SkinnedVertex> &skinned, ThreadPool *pool, SkinningKernel kernel){
+    skinned.resize(vertices.size());
+    if(vertices.empty()){
+        return;
+    }
+    
+    const Vertex *source = &vertices[0];
+    const glm::mat4 *bones = palette.empty() ? nullptr : &palette[0];
+    int paletteSize = (int)palette.size();
+    SkinnedVertex *destination = &skinned[0];
+    
+    if(!pool){
+        SkinRange(kernel, source, vertices.size(), bones, paletteSize, destination);
+        return;
+    }
+    
+    pool->ParallelFor(vertices.size(), SKINNING_GRAIN_SIZE, [&](size_t begin, size_t end){
+        SkinRange(kernel, source + begin, end - begin, bones, paletteSize, destination + begin);
+    });
+}
+
+void CpuSkinning::SkinRange(SkinningKernel kernel, const Vertex *vertices, size_t count,
+                            const glm::mat4 *palette, int paletteSize, SkinnedVertex *skinned){
+#ifdef CPU_SKINNING_X86
+    if(kernel == SKINNING_KERNEL_AVX2 && GetBestKernel() == SKINNING_KERNEL_AVX2){
+        SkinRangeAVX2(vertices, count, palette, paletteSize, skinned);
+        return;
+    }
+    if(kernel != SKINNING_KERNEL_SCALAR){
+        SkinRangeSSE(vertices, count, palette, paletteSize, skinned);
+        return;
+    }
+#endif
+    SkinRangeScalar(vertices, count, palette, paletteSize, skinned);
+}
+
+/* Returns false if the vertex has to stay in its bind pose, either because no bone
+    influences it or because it references a bone outside the palette (as mesh.vs does) */
+static inline bool isSkinnable(const Vertex &vertex, int paletteSize){
+    bool influenced = false;
+    for(int i=0; i<MAX_BONE_INFLUENCE; i++){
+        if(vertex.mBoneIds[i] == -1){
+            continue;
+        }
+        if(vertex.mBoneIds[i] >= paletteSize){
+            return false;
+        }
+        influenced = true;
+    }
+    return influenced;
+}
+
+void CpuSkinning::SkinRangeScalar(const Vertex *vertices, size_t count, const glm::mat4 *palette, int paletteSize, SkinnedVertex *skinned){
+    for(size_t v=0; v<count; v++){
+        const Vertex &vertex = vertices[v];
+        if(!isSkinnable(vertex, paletteSize)){
+            skinned[v].position = vertex.position;
+            skinned[v].normal = vertex.normal;
+            continue;
+        }
+        
+        // Blend the bone matrices first, then transform once
+        glm::mat4 skinMatrix(0.0f);
+        for(int i=0; i<MAX_BONE_INFLUENCE; i++){
+            if(vertex.mBoneIds[i] == -1){
+                continue;
+            }
+            skinMatrix += palette[vertex.mBoneIds[i]] * vertex.mWeights[i];
+        }
+        
+        skinned[v].position = glm::vec3(skinMatrix * glm::vec4(vertex.position, 1.0f));
+        skinned[v].normal = glm::normalize(glm::vec3(skinMatrix * glm::vec4(vertex.normal, 0.0f)));
+    }
+}
+
+#ifdef CPU_SKINNING_X86
+
+static inline void storeVec3(glm::vec3 &destination, __m128 value){
+    float result[4];
+    _mm_storeu_ps(result, value);
+    destination = glm::vec3(result[0], result[1], result[2]);
+}
+
+/* Normalises the xyz part, w is expected to be 0 */
+static inline __m128 normalizeSSE(__m128 value){
+    __m128 squared = _mm_mul_ps(value, value);
+    __m128 sum = _mm_add_ps(squared, _mm_shuffle_ps(squared, squared, _MM_SHUFFLE(2, 3, 0, 1)));
+    sum = _mm_add_ps(sum, _mm_shuffle_ps(sum, sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    return _mm_div_ps(value, _mm_sqrt_ps(sum));
+}
+
+void CpuSkinning::SkinRangeSSE(const Vertex *vertices, size_t count, const glm::mat4 *palette, int paletteSize, SkinnedVertex *skinned){
+    for(size_t v=0; v<count; v++){
+        const Vertex &vertex = vertices[v];
+        if(!isSkinnable(vertex, paletteSize)){
+            skinned[v].position = vertex.position;
+            skinned[v].normal = vertex.normal;
+            continue;
+        }
+        
+        // One register per matrix column
+        __m128 column0 = _mm_setzero_ps();
+        __m128 column1 = _mm_setzero_ps();
+        __m128 column2 = _mm_setzero_ps();
+        __m128 column3 = _mm_setzero_ps();
+        for(int i=0; i<MAX_BONE_INFLUENCE; i++){
+            if(vertex.mBoneIds[i] == -1){
+                continue;
+            }
+            const float *bone = &palette[vertex.mBoneIds[i]][0][0];
+            __m128 weight = _mm_set1_ps(vertex.mWeights[i]);
+            column0 = _mm_add_ps(column0, _mm_mul_ps(_mm_loadu_ps(bone + 0), weight));
+            column1 = _mm_add_ps(column1, _mm_mul_ps(_mm_loadu_ps(bone + 4), weight));
+            column2 = _mm_add_ps(column2, _mm_mul_ps(_mm_loadu_ps(bone + 8), weight));
+            column3 = _mm_add_ps(column3, _mm_mul_ps(_mm_loadu_ps(bone + 12), weight));
+        }
+        
+        __m128 position = _mm_add_ps(_mm_add_ps(_mm_mul_ps(column0, _mm_set1_ps(vertex.position.x)),
+                                                _mm_mul_ps(column1, _mm_set1_ps(vertex.position.y))),
+                                     _mm_add_ps(_mm_mul_ps(column2, _mm_set1_ps(vertex.position.z)), column3));
+        __m128 normal = _mm_add_ps(_mm_add_ps(_mm_mul_ps(column0, _mm_set1_ps(vertex.normal.x)),
+                                              _mm_mul_ps(column1, _mm_set1_ps(vertex.normal.y))),
+                                   _mm_mul_ps(column2, _mm_set1_ps(vertex.normal.z)));
+        
+        storeVec3(skinned[v].position, position);
+        storeVec3(skinned[v].normal, normalizeSSE(normal));
+    }
+}
+
+/* Columns 0-1 and 2-3 of the blended matrix each fit in one 256 bit register, so the
+    blend takes two FMAs per influence and the transform two more */
+__attribute__((target("avx2,fma")))
+void CpuSkinning::SkinRangeAVX2(const Vertex *vertices, size_t count, const glm::mat4 *palette, int paletteSize, SkinnedVertex *skinned){
+    for(size_t v=0; v<count; v++){
+        const Vertex &vertex = vertices[v];
+        if(!isSkinnable(vertex, paletteSize)){
+            skinned[v].position = vertex.position;
+            skinned[v].normal = vertex.normal;
+            continue;
+        }
+        
+        __m256 columns01 = _mm256_setzero_ps();
+        __m256 columns23 = _mm256_setzero_ps();
+        for(int i=0; i<MAX_BONE_INFLUENCE; i++){
+            if(vertex.mBoneIds[i] == -1){
+                continue;
+            }
+            const float *bone = &palette[vertex.mBoneIds[i]][0][0];
+            __m256 weight = _mm256_set1_ps(vertex.mWeights[i]);
+            columns01 = _mm256_fmadd_ps(_mm256_loadu_ps(bone + 0), weight, columns01);
+            columns23 = _mm256_fmadd_ps(_mm256_loadu_ps(bone + 8), weight, columns23);
+        }
+        
+        // [c0*x | c1*y] + [c2*z | c3*1], then fold the two halves together
+        __m256 positionXY = _mm256_setr_m128(_mm_set1_ps(vertex.position.x), _mm_set1_ps(vertex.position.y));
+        __m256 positionZW = _mm256_setr_m128(_mm_set1_ps(vertex.position.z), _mm_set1_ps(1.0f));
+        __m256 position = _mm256_fmadd_ps(columns23, positionZW, _mm256_mul_ps(columns01, positionXY));
+        
+        __m256 normalXY = _mm256_setr_m128(_mm_set1_ps(vertex.normal.x), _mm_set1_ps(vertex.normal.y));
+        __m256 normalZW = _mm256_setr_m128(_mm_set1_ps(vertex.normal.z), _mm_setzero_ps());
+        __m256 normal = _mm256_fmadd_ps(columns23, normalZW, _mm256_mul_ps(columns01, normalXY));
+        
+        storeVec3(skinned[v].position, _mm_add_ps(_mm256_castps256_ps128(position), _mm256_extractf128_ps(position, 1)));
+        storeVec3(skinned[v].normal, normalizeSSE(_mm_add_ps(_mm256_castps256_ps128(normal), _mm256_extractf128_ps(normal, 1))));
+    }
+}
+
+#endif
@@ -0,0 +1,60 @@
+//
+//  CpuSkinning.hpp
+//  ModelLoader
+//
+//  Created by Apple on 19/10/26.
+//
+
+#ifndef CpuSkinning_hpp
+#define CpuSkinning_hpp
+
+#include <stdio.h>
+#include <vector>
+#include <glm/glm.hpp>
+
+#include "Mesh.hpp"
+#include "ThreadPool.hpp"
+
+struct SkinnedVertex{
+    glm::vec3 position;
+    glm::vec3 normal;
+};
+
+enum SkinningKernel{
+    SKINNING_KERNEL_SCALAR,     // Reference implementation, plain glm
+    SKINNING_KERNEL_SSE,        // 4 wide, every x86-64 CPU has it
+    SKINNING_KERNEL_AVX2        // 8 wide with FMA, picked at runtime when the CPU supports it
+};
+
+/* Same skinning as mesh.vs with SKINNED but on the CPU, for consumers without a GL context such
+    as server side hit detection or offline processing. Vertices whose bones are all unset
+    keep their bind pose position */
+class CpuSkinning{
+public:
+    /* Fastest kernel the running CPU supports */
+    static SkinningKernel GetBestKernel();
+    static const char* GetKernelName(SkinningKernel kernel);
+    
+    /* Skins every vertex with a palette indexed like the vertices' bone ids, for a model's
+        mesh the slice Mesh::gatherPalette takes from Animator::GetFinalBoneMatrices. When
+        a pool is given the vertices are split in ranges across its workers */
+    static void Skin(const std::vector<Vertex> &vertices,
+                     const std::vector<glm::mat4> &palette,
+                     std::vector<SkinnedVertex> &skinned,
+                     ThreadPool *pool = nullptr);
+    static void Skin(const std::vector<Vertex> &vertices,
+                     const std::vector<glm::mat4> &palette,
+                     std::vector<SkinnedVertex> &skinned,
+                     ThreadPool *pool,
+                     SkinningKernel kernel);
+    
+    /* Skins count vertices on the calling thread with the given kernel */
+    static void SkinRange(SkinningKernel kernel, const Vertex *vertices, size_t count,
+                          const glm::mat4 *palette, int paletteSize, SkinnedVertex *skinned);
+    
+private:
+    static void SkinRangeScalar(const Vertex *vertices, size_t count, const glm::mat4 *palette, int paletteSize, SkinnedVertex *skinned);
+    static void SkinRangeSSE(const Vertex *vertices, size_t count, const glm::mat4 *palette, int paletteSize, SkinnedVertex *skinned);
+    static void SkinRangeAVX2(const Vertex *vertices, size_t count, const glm::mat4 *palette, int paletteSize, SkinnedVertex *skinned);
+};
+#endif /* CpuSkinning_hpp */
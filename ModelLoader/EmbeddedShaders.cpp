@@ -0,0 +1,51 @@
+//
+//  EmbeddedShaders.cpp
+//  ModelLoader
+//
+//  Created by Apple on 19/10/26.
+//
+
+#include "EmbeddedShaders.hpp"
+
+// Generated into DERIVED_FILE_DIR by the "Embed Shaders" build phase
+#if defined(__has_include)
+#if __has_include("EmbeddedShaderSources.inc")
+#include "EmbeddedShaderSources.inc"
+#define HAS_EMBEDDED_SHADERS 1
+#endif
+#endif
+
+#ifndef HAS_EMBEDDED_SHADERS
+static constexpr EmbeddedShader EMBEDDED_SHADERS[] = { { "", "", 0, 0 } };
+#endif
+
+static const char* GetSourceDirectory(){
+    static const char *directory = getenv(SHADER_SOURCE_DIRECTORY_VARIABLE);
+    return directory;
+}
+
+const EmbeddedShader* EmbeddedShaders::Find(const std::string &location){
+    if(GetSourceDirectory()){
+        return nullptr;
+    }
+    // A few dozen entries, a linear scan is plenty
+    for(int i=0; i<GetCount(); i++){
+        if(location == EMBEDDED_SHADERS[i].location){
+            return &EMBEDDED_SHADERS[i];
+        }
+    }
+    return nullptr;
+}
+
+std::string EmbeddedShaders::GetDiskLocation(const std::string &location){
+    const char *directory = GetSourceDirectory();
+    return directory ? std::string(directory) + "/" + location : location;
+}
+
+int EmbeddedShaders::GetCount(){
+#ifdef HAS_EMBEDDED_SHADERS
+    return (int)(sizeof(EMBEDDED_SHADERS) / sizeof(EMBEDDED_SHADERS[0]));
+#else
+    return 0;
+#endif
+}
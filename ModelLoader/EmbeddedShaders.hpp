@@ -0,0 +1,40 @@
+//
+//  EmbeddedShaders.hpp
+//  ModelLoader
+//
+//  Created by Apple on 19/10/26.
+//
+
+#ifndef EmbeddedShaders_hpp
+#define EmbeddedShaders_hpp
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string>
+#include <cstdlib>
+#include <cstring>
+
+// Environment variable naming a source root to read the shaders from instead, to edit
+// them without rebuilding
+#define SHADER_SOURCE_DIRECTORY_VARIABLE "SHADER_SOURCE_DIRECTORY"
+
+/* A file of resources/shaders compiled into the binary by embed_shaders.py */
+struct EmbeddedShader{
+    const char *location;       // Relative to the source root, as passed to Shader
+    const char *source;
+    size_t length;
+    uint64_t hash;              // FNV-1a of the source with its includes pasted in
+};
+
+/* Lookup of the shaders embedded at build time, so startup does no shader file I/O and
+    doesn't depend on the working directory. Builds without the embed step have none and
+    Shader reads the files as before */
+class EmbeddedShaders{
+public:
+    /* nullptr if location wasn't embedded, or if SHADER_SOURCE_DIRECTORY is set */
+    static const EmbeddedShader* Find(const std::string &location);
+    /* Where a shader is read from when it isn't embedded */
+    static std::string GetDiskLocation(const std::string &location);
+    static int GetCount();
+};
+#endif /* EmbeddedShaders_hpp */
@@ -0,0 +1,134 @@
+//
+//  GLState.cpp
+//  ModelLoader
+//
+//  Created by Apple on 19/10/26.
+//
+
+#include "GLState.hpp"
+
+unsigned int GLState::program = GLState::UNKNOWN;
+unsigned int GLState::vertexArray = GLState::UNKNOWN;
+unsigned int GLState::activeUnit = GLState::UNKNOWN;
+unsigned int GLState::textures[GL_STATE_MAX_TEXTURE_UNITS][TEXTURE_TARGET_COUNT];
+GLStateCounters GLState::counters;
+
+// Statics can't be filled with UNKNOWN by their initialiser
+static bool texturesInitialised = false;
+
+void GLState::UseProgram(unsigned int program){
+    if(GLState::program == program){
+        counters.skipped[GL_STATE_USE_PROGRAM]++;
+        return;
+    }
+    glUseProgram(program);
+    GLState::program = program;
+    counters.issued[GL_STATE_USE_PROGRAM]++;
+}
+
+void GLState::BindVertexArray(unsigned int vertexArray){
+    if(GLState::vertexArray == vertexArray){
+        counters.skipped[GL_STATE_BIND_VERTEX_ARRAY]++;
+        return;
+    }
+    glBindVertexArray(vertexArray);
+    GLState::vertexArray = vertexArray;
+    counters.issued[GL_STATE_BIND_VERTEX_ARRAY]++;
+}
+
+void GLState::ActiveTexture(GLenum texture){
+    unsigned int unit = texture - GL_TEXTURE0;
+    if(activeUnit == unit){
+        counters.skipped[GL_STATE_ACTIVE_TEXTURE]++;
+        return;
+    }
+    glActiveTexture(texture);
+    activeUnit = unit;
+    counters.issued[GL_STATE_ACTIVE_TEXTURE]++;
+}
+
+void GLState::BindTexture(GLenum target, unsigned int texture){
+    if(!texturesInitialised){
+        Invalidate();
+    }
+    int targetIndex = getTextureTarget(target);
+    bool tracked = targetIndex >= 0 && activeUnit < GL_STATE_MAX_TEXTURE_UNITS;
+    if(tracked && textures[activeUnit][targetIndex] == texture){
+        counters.skipped[GL_STATE_BIND_TEXTURE]++;
+        return;
+    }
+    glBindTexture(target, texture);
+    if(tracked){
+        textures[activeUnit][targetIndex] = texture;
+    }
+    counters.issued[GL_STATE_BIND_TEXTURE]++;
+}
+
+void GLState::BindTextureUnit(unsigned int unit, GLenum target, unsigned int texture){
+    if(!texturesInitialised){
+        Invalidate();
+    }
+    int targetIndex = getTextureTarget(target);
+    if(targetIndex >= 0 && unit < GL_STATE_MAX_TEXTURE_UNITS && textures[unit][targetIndex] == texture){
+        counters.skipped[GL_STATE_BIND_TEXTURE]++;
+        return;
+    }
+    ActiveTexture(GL_TEXTURE0 + unit);
+    BindTexture(target, texture);
+}
+
+void GLState::DeleteProgram(unsigned int program){
+    glDeleteProgram(program);
+    // A deleted program stays in use until another one is, its name may come back meanwhile
+    if(GLState::program == program){
+        GLState::program = UNKNOWN;
+    }
+}
+
+void GLState::DeleteTextures(int count, const unsigned int *textures){
+    glDeleteTextures(count, textures);
+    // GL unbinds deleted textures from every unit
+    for(int i=0; i<count; i++){
+        for(int unit=0; unit<GL_STATE_MAX_TEXTURE_UNITS; unit++){
+            for(int target=0; target<TEXTURE_TARGET_COUNT; target++){
+                if(GLState::textures[unit][target] == textures[i]){
+                    GLState::textures[unit][target] = 0;
+                }
+            }
+        }
+    }
+}
+
+void GLState::Invalidate(){
+    program = UNKNOWN;
+    vertexArray = UNKNOWN;
+    activeUnit = UNKNOWN;
+    for(int unit=0; unit<GL_STATE_MAX_TEXTURE_UNITS; unit++){
+        for(int target=0; target<TEXTURE_TARGET_COUNT; target++){
+            textures[unit][target] = UNKNOWN;
+        }
+    }
+    texturesInitialised = true;
+}
+
+void GLState::ResetCounters(){
+    counters = GLStateCounters();
+}
+
+std::string GLState::FormatCounters(){
+    const char *names[GL_STATE_CALL_COUNT] = { "programs", "vertex arrays", "active textures", "textures" };
+    std::string report;
+    for(int call=0; call<GL_STATE_CALL_COUNT; call++){
+        report += std::string(call > 0 ? ", " : "") + names[call] + " "
+                + std::to_string(counters.issued[call]) + "/" + std::to_string(counters.issued[call] + counters.skipped[call]);
+    }
+    return report;
+}
+
+int GLState::getTextureTarget(GLenum target){
+    switch(target){
+        case GL_TEXTURE_2D:     return TEXTURE_TARGET_2D;
+        case GL_TEXTURE_BUFFER: return TEXTURE_TARGET_BUFFER;
+        default:                return -1;
+    }
+}
@@ -0,0 +1,83 @@
+//
+//  GLState.hpp
+//  ModelLoader
+//
+//  Created by Apple on 19/10/26.
+//
+
+#ifndef GLState_hpp
+#define GLState_hpp
+
+#include <stdio.h>
+#include <string>
+#include <GL/glew.h>
+
+// Texture units whose bindings are tracked, binds on higher units always reach the driver
+#define GL_STATE_MAX_TEXTURE_UNITS 32
+
+enum GLStateCall{
+    GL_STATE_USE_PROGRAM,
+    GL_STATE_BIND_VERTEX_ARRAY,
+    GL_STATE_ACTIVE_TEXTURE,
+    GL_STATE_BIND_TEXTURE,
+    GL_STATE_CALL_COUNT
+};
+
+/* Calls made through GLState since the last ResetCounters, per GLStateCall */
+struct GLStateCounters{
+    unsigned int issued[GL_STATE_CALL_COUNT] = {};      // Reached the driver
+    unsigned int skipped[GL_STATE_CALL_COUNT] = {};     // State was already current
+};
+
+/* Shadow of the binding state of the single GL context, in front of the bind calls the
+    draws repeat for every mesh. A call whose state is already current is not passed on.
+    Every bind of the tracked state has to go through here, and deleting a bound program
+    or texture through the Delete functions, or the shadow goes stale. After code that
+    binds behind its back, call Invalidate */
+class GLState{
+public:
+    // -- Binds
+    static void UseProgram(unsigned int program);
+    static void BindVertexArray(unsigned int vertexArray);
+    /* texture is GL_TEXTURE0 + unit, as for glActiveTexture */
+    static void ActiveTexture(GLenum texture);
+    /* Binds on the active unit, as glBindTexture */
+    static void BindTexture(GLenum target, unsigned int texture);
+    /* Binds on unit, only switching the active unit when the bind is needed. Prefer it in
+        draw loops, where most binds are skipped */
+    static void BindTextureUnit(unsigned int unit, GLenum target, unsigned int texture);
+    
+    // -- Deletes, forgetting the deleted names
+    static void DeleteProgram(unsigned int program);
+    static void DeleteTextures(int count, const unsigned int *textures);
+    
+    /* Forgets everything, the next call of each kind reaches the driver */
+    static void Invalidate();
+    
+    // -- Counters
+    static const GLStateCounters& GetCounters() { return counters; }
+    static void ResetCounters();
+    /* "issued/requested" per call, for the logs */
+    static std::string FormatCounters();
+    
+private:
+    // Tracked targets, binds on other targets are passed through
+    enum TextureTarget{
+        TEXTURE_TARGET_2D,
+        TEXTURE_TARGET_BUFFER,
+        TEXTURE_TARGET_COUNT
+    };
+    
+    static const unsigned int UNKNOWN = ~0u;
+    
+    // Properties
+    static unsigned int program;
+    static unsigned int vertexArray;
+    static unsigned int activeUnit;
+    static unsigned int textures[GL_STATE_MAX_TEXTURE_UNITS][TEXTURE_TARGET_COUNT];
+    static GLStateCounters counters;
+    
+    // Functions
+    static int getTextureTarget(GLenum target);
+};
+#endif /* GLState_hpp */
@@ -0,0 +1,206 @@
+//
+//  GpuAnimation.cpp
+//  ModelLoader
+//
+//  Created by Apple on 19/10/26.
+//
+
+#include "GpuAnimation.hpp"
+
+// Must match local_size_x in animation_sample.cs
+static const int SAMPLE_GROUP_SIZE = 64;
+
+GpuAnimation::GpuAnimation(const Animation *clip, int maxInstances)
+        : mClip(clip), mSampleShader("resources/shaders/animation_sample.cs"), mPaletteTexture(0),
+          mMaxInstances(maxInstances), mInstanceCount(0){
+    const Skeleton &skeleton = *clip->GetSkeleton();
+    const std::vector<SkeletonNode> &skeletonNodes = skeleton.GetNodes();
+    const LocalPose &bindPose = skeleton.GetBindPose();
+    const std::vector<Bone> &bones = clip->GetBones();
+    mNodeCount = (int)skeletonNodes.size();
+    mBoneCount = skeleton.GetBoneCount();
+    
+    // Tracks are laid out 3 per channel, in channel order
+    std::vector<GpuTrack> tracks;
+    std::vector<float> keyFloats;
+    std::vector<unsigned int> rotationKeys;
+    for(size_t i=0; i<bones.size(); i++){
+        AddVectorTrack(bones[i].GetPositionTrack(), tracks, keyFloats);
+        AddRotationTrack(bones[i].GetRotationTrack(), tracks, keyFloats, rotationKeys);
+        AddVectorTrack(bones[i].GetScaleTrack(), tracks, keyFloats);
+    }
+    
+    std::vector<GpuNode> nodes(mNodeCount);
+    for(int i=0; i<mNodeCount; i++){
+        GpuNode &node = nodes[i];
+        int channel = clip->GetNodeChannel(i);
+        node.parent = skeletonNodes[i].parent;
+        node.firstTrack = channel >= 0 ? channel * 3 : -1;
+        node.boneId = skeletonNodes[i].boneId;
+        node.padding = 0;
+        node.translation = glm::vec4(bindPose.translation[0][i], bindPose.translation[1][i], bindPose.translation[2][i], 0.0f);
+        node.rotation = glm::vec4(bindPose.rotation[0][i], bindPose.rotation[1][i], bindPose.rotation[2][i], bindPose.rotation[3][i]);
+        node.scale = glm::vec4(bindPose.scale[0][i], bindPose.scale[1][i], bindPose.scale[2][i], 0.0f);
+    }
+    
+    std::vector<glm::mat4> boneOffsets(std::max(mBoneCount, 1), glm::mat4(1.0f));
+    for(int i=0; i<mBoneCount; i++){
+        boneOffsets[i] = skeleton.GetBoneOffset(i);
+    }
+    
+    // Empty buffers can't be bound, keep at least one element in each
+    keyFloats.push_back(0.0f);
+    rotationKeys.push_back(0);
+    rotationKeys.push_back(0);
+    if(tracks.empty()){
+        tracks.push_back(GpuTrack());
+    }
+    
+    mBuffers[BINDING_NODES] = CreateStorageBuffer(&nodes[0], nodes.size() * sizeof(GpuNode), GL_STATIC_DRAW);
+    mBuffers[BINDING_BONE_OFFSETS] = CreateStorageBuffer(&boneOffsets[0], boneOffsets.size() * sizeof(glm::mat4), GL_STATIC_DRAW);
+    mBuffers[BINDING_TRACKS] = CreateStorageBuffer(&tracks[0], tracks.size() * sizeof(GpuTrack), GL_STATIC_DRAW);
+    mBuffers[BINDING_KEY_FLOATS] = CreateStorageBuffer(&keyFloats[0], keyFloats.size() * sizeof(float), GL_STATIC_DRAW);
+    mBuffers[BINDING_ROTATION_KEYS] = CreateStorageBuffer(&rotationKeys[0], rotationKeys.size() * sizeof(unsigned int), GL_STATIC_DRAW);
+    mBuffers[BINDING_INSTANCE_TIMES] = CreateStorageBuffer(NULL, mMaxInstances * sizeof(float), GL_STREAM_DRAW);
+    mBuffers[BINDING_PALETTES] = CreateStorageBuffer(NULL, (size_t)mMaxInstances * std::max(mBoneCount, 1) * 3 * sizeof(glm::vec4), GL_DYNAMIC_COPY);
+    mBuffers[BINDING_GLOBAL_TRANSFORMS] = CreateStorageBuffer(NULL, (size_t)mMaxInstances * mNodeCount * sizeof(glm::mat4), GL_DYNAMIC_COPY);
+    
+    // The vertex shader reads the palettes through a buffer texture, which GL 3.3 has
+    glGenTextures(1, &mPaletteTexture);
+    GLState::BindTexture(GL_TEXTURE_BUFFER, mPaletteTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, mBuffers[BINDING_PALETTES]);
+    GLState::BindTexture(GL_TEXTURE_BUFFER, 0);
+    
+    size_t trackBytes = tracks.size() * sizeof(GpuTrack) + keyFloats.size() * sizeof(float) + rotationKeys.size() * sizeof(unsigned int);
+    LOGGER("Uploaded "+std::to_string(bones.size())+" channels for GPU sampling, "+std::to_string(trackBytes)+" bytes of tracks");
+}
+
+GpuAnimation::~GpuAnimation(){
+    GLState::DeleteTextures(1, &mPaletteTexture);
+    glDeleteBuffers(BINDING_COUNT, mBuffers);
+    GLState::DeleteProgram(mSampleShader.ID);
+}
+
+bool GpuAnimation::IsSupported(){
+    return GLEW_VERSION_4_3 || (GLEW_ARB_compute_shader && GLEW_ARB_shader_storage_buffer_object);
+}
+
+void GpuAnimation::Dispatch(const std::vector<float> &instanceTimes){
+    mInstanceCount = std::min((int)instanceTimes.size(), mMaxInstances);
+    if(mInstanceCount == 0){
+        return;
+    }
+    
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, mBuffers[BINDING_INSTANCE_TIMES]);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, mInstanceCount * sizeof(float), &instanceTimes[0]);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    
+    for(unsigned int i=0; i<BINDING_COUNT; i++){
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, mBuffers[i]);
+    }
+    
+    mSampleShader.use();
+    mSampleShader.setInteger("instanceCount", mInstanceCount);
+    mSampleShader.setInteger("nodeCount", mNodeCount);
+    mSampleShader.setInteger("boneCount", mBoneCount);
+    mSampleShader.setFloat("ticksPerSecond", mClip->GetTicksPerSecond());
+    mSampleShader.setFloat("duration", mClip->GetDuration());
+    glDispatchCompute((mInstanceCount + SAMPLE_GROUP_SIZE - 1) / SAMPLE_GROUP_SIZE, 1, 1);
+    
+    // Palettes are read through a texture by the draw, or copied back for validation
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+}
+
+void GpuAnimation::Bind(Shader &shader, unsigned int textureUnit){
+    GLState::BindTextureUnit(textureUnit, GL_TEXTURE_BUFFER, mPaletteTexture);
+    
+    shader.setInteger("instancePalettes", textureUnit);
+    shader.setInteger("paletteBoneCount", mBoneCount);
+}
+
+float GpuAnimation::ValidateAgainstCPU(const std::vector<float> &instanceTimes){
+    Dispatch(instanceTimes);
+    
+    std::vector<glm::vec4> rows((size_t)mInstanceCount * mBoneCount * 3);
+    if(!rows.empty()){
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, mBuffers[BINDING_PALETTES]);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, rows.size() * sizeof(glm::vec4), &rows[0]);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+    
+    Animator reference(mClip);
+    float maxError = 0.0f;
+    for(int instance=0; instance<mInstanceCount; instance++){
+        reference.SetAnimationTime(instanceTimes[instance] * mClip->GetTicksPerSecond());
+        const std::vector<glm::mat4> &palette = reference.GetFinalBoneMatrices();
+        
+        for(int bone=0; bone<mBoneCount && bone<(int)palette.size(); bone++){
+            for(int row=0; row<3; row++){
+                const glm::vec4 &gpuRow = rows[((size_t)instance * mBoneCount + bone) * 3 + row];
+                for(int column=0; column<4; column++){
+                    float expected = palette[bone][column][row];
+                    float error = fabsf(gpuRow[column] - expected) / std::max(1.0f, fabsf(expected));
+                    maxError = std::max(maxError, error);
+                }
+            }
+        }
+    }
+    
+    LOGGER("GPU sampling of "+std::to_string(mInstanceCount)+" instances differs from the CPU by at most "+std::to_string(maxError));
+    return maxError;
+}
+
+template<typename T>
+void GpuAnimation::AddVectorTrack(const Track<T> &track, std::vector<GpuTrack> &tracks, std::vector<float> &keyFloats){
+    GpuTrack gpuTrack = GpuTrack();
+    gpuTrack.type = track.type;
+    gpuTrack.firstKey = (int)keyFloats.size();
+    gpuTrack.keyCount = track.type == TRACK_CONSTANT ? 1 : track.keyCount;
+    gpuTrack.inverseInterval = track.inverseInterval;
+    gpuTrack.startTime = track.keyCount == 0 ? 0.0f : track.times[0];
+    
+    for(int i=0; i<gpuTrack.keyCount; i++){
+        keyFloats.push_back(track.values[i].x);
+        keyFloats.push_back(track.values[i].y);
+        keyFloats.push_back(track.values[i].z);
+    }
+    AddTimes(track.times, track.keyCount, gpuTrack, keyFloats);
+    tracks.push_back(gpuTrack);
+}
+
+void GpuAnimation::AddRotationTrack(const Track<glm::quat> &track, std::vector<GpuTrack> &tracks, std::vector<float> &keyFloats, std::vector<unsigned int> &rotationKeys){
+    GpuTrack gpuTrack = GpuTrack();
+    gpuTrack.type = track.type;
+    gpuTrack.firstKey = (int)rotationKeys.size() / 2;
+    gpuTrack.keyCount = track.type == TRACK_CONSTANT ? 1 : track.keyCount;
+    gpuTrack.inverseInterval = track.inverseInterval;
+    gpuTrack.startTime = track.keyCount == 0 ? 0.0f : track.times[0];
+    
+    // Unit quaternions lose little to half precision
+    for(int i=0; i<gpuTrack.keyCount; i++){
+        const glm::quat &rotation = track.values[i];
+        rotationKeys.push_back(glm::packHalf2x16(glm::vec2(rotation.x, rotation.y)));
+        rotationKeys.push_back(glm::packHalf2x16(glm::vec2(rotation.z, rotation.w)));
+    }
+    AddTimes(track.times, track.keyCount, gpuTrack, keyFloats);
+    tracks.push_back(gpuTrack);
+}
+
+void GpuAnimation::AddTimes(const float *times, int keyCount, GpuTrack &gpuTrack, std::vector<float> &keyFloats){
+    // Constant tracks need no time, evenly spaced ones compute the key from the time
+    if(gpuTrack.type == TRACK_CONSTANT || gpuTrack.type == TRACK_UNIFORM){
+        gpuTrack.firstTime = -1;
+        return;
+    }
+    gpuTrack.firstTime = (int)keyFloats.size();
+    keyFloats.insert(keyFloats.end(), times, times + keyCount);
+}
+
+unsigned int GpuAnimation::CreateStorageBuffer(const void *data, size_t size, GLenum usage){
+    unsigned int buffer;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, size, data, usage);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    return buffer;
+}
@@ -0,0 +1,99 @@
+//
+//  GpuAnimation.hpp
+//  ModelLoader
+//
+//  Created by Apple on 19/10/26.
+//
+
+#ifndef GpuAnimation_hpp
+#define GpuAnimation_hpp
+
+#include <stdio.h>
+#include <GL/glew.h>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+#include "Animator.hpp"
+#include "Shader.hpp"
+
+/* Samples one clip and solves its hierarchy for every instance of a crowd in a compute
+    shader (animation_sample.cs), writing the palettes into a buffer the vertex shader
+    (animation_compute.vs) reads by gl_InstanceID. Tracks are uploaded compressed:
+    constant tracks keep a single key, evenly spaced tracks drop their key times and
+    rotations are stored as half floats. Needs GL 4.3, check IsSupported first */
+class GpuAnimation{
+public:
+    // -- Constructors and Destructor
+    GpuAnimation(const Animation *clip, int maxInstances);
+    ~GpuAnimation();
+    
+    /* Compute shaders and storage buffers are available in the current context */
+    static bool IsSupported();
+    
+    /* Solves the palette of every instance at its time in seconds */
+    void Dispatch(const std::vector<float> &instanceTimes);
+    
+    /* Binds the palettes as a buffer texture to the given unit for animation_compute.vs */
+    void Bind(Shader &shader, unsigned int textureUnit);
+    
+    /* Dispatches, reads the palettes back and compares them with Animator's on the CPU.
+        Returns the largest difference, relative to the size of the reference value */
+    float ValidateAgainstCPU(const std::vector<float> &instanceTimes);
+    
+    // -- Getters
+    int GetBoneCount() const { return mBoneCount; }
+    int GetMaxInstances() const { return mMaxInstances; }
+    
+private:
+    // std430 layouts, must match animation_sample.cs
+    struct GpuNode{
+        int parent;
+        int firstTrack;         // Position track, rotation and scale follow. -1 for the bind pose
+        int boneId;
+        int padding;
+        glm::vec4 translation;  // Bind pose
+        glm::vec4 rotation;
+        glm::vec4 scale;
+    };
+    
+    struct GpuTrack{
+        int type;               // TrackType
+        int firstKey;           // In the key floats (3 per key) or the rotation keys (2 per key)
+        int keyCount;
+        int firstTime;          // In the key floats, -1 when no time is stored
+        float inverseInterval;
+        float startTime;
+        float padding[2];
+    };
+    
+    enum StorageBinding{
+        BINDING_NODES,
+        BINDING_BONE_OFFSETS,
+        BINDING_TRACKS,
+        BINDING_KEY_FLOATS,
+        BINDING_ROTATION_KEYS,
+        BINDING_INSTANCE_TIMES,
+        BINDING_PALETTES,
+        BINDING_GLOBAL_TRANSFORMS,
+        BINDING_COUNT
+    };
+    
+    // Properties
+    const Animation *mClip;
+    Shader mSampleShader;
+    unsigned int mBuffers[BINDING_COUNT];
+    unsigned int mPaletteTexture;
+    int mNodeCount;
+    int mBoneCount;
+    int mMaxInstances;
+    int mInstanceCount;
+    
+    // Functions
+    template<typename T>
+    void AddVectorTrack(const Track<T> &track, std::vector<GpuTrack> &tracks, std::vector<float> &keyFloats);
+    void AddRotationTrack(const Track<glm::quat> &track, std::vector<GpuTrack> &tracks, std::vector<float> &keyFloats, std::vector<unsigned int> &rotationKeys);
+    static void AddTimes(const float *times, int keyCount, GpuTrack &gpuTrack, std::vector<float> &keyFloats);
+    static unsigned int CreateStorageBuffer(const void *data, size_t size, GLenum usage);
+};
+#endif /* GpuAnimation_hpp */
@@ -0,0 +1,216 @@
+//
+//  LocalPose.cpp
+//  ModelLoader
+//
+//  Created by Apple on 19/10/26.
+//
+
+#include "LocalPose.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define LOCAL_POSE_SSE 1
+#include <xmmintrin.h>
+#endif
+
+void LocalPose::Resize(size_t nodeCount){
+    size_t paddedCount = (nodeCount + 3) & ~(size_t)3;
+    for(int i=0; i<3; i++){
+        translation[i].resize(paddedCount, 0.0f);
+        scale[i].resize(paddedCount, 1.0f);
+    }
+    for(int i=0; i<3; i++){
+        rotation[i].resize(paddedCount, 0.0f);
+    }
+    rotation[3].resize(paddedCount, 1.0f);
+}
+
+void LocalPose::Set(size_t node, const glm::vec3 &position, const glm::quat &orientation, const glm::vec3 &scaling){
+    translation[0][node] = position.x;
+    translation[1][node] = position.y;
+    translation[2][node] = position.z;
+    rotation[0][node] = orientation.x;
+    rotation[1][node] = orientation.y;
+    rotation[2][node] = orientation.z;
+    rotation[3][node] = orientation.w;
+    scale[0][node] = scaling.x;
+    scale[1][node] = scaling.y;
+    scale[2][node] = scaling.z;
+}
+
+void LocalPose::Copy(size_t node, const LocalPose &source){
+    for(int i=0; i<3; i++){
+        translation[i][node] = source.translation[i][node];
+        scale[i][node] = source.scale[i][node];
+    }
+    for(int i=0; i<4; i++){
+        rotation[i][node] = source.rotation[i][node];
+    }
+}
+
+glm::mat4 LocalPose::GetMatrix(size_t node) const{
+    // translation * rotation * scale, written out
+    glm::quat orientation(rotation[3][node], rotation[0][node], rotation[1][node], rotation[2][node]);
+    glm::mat4 matrix = glm::mat4_cast(orientation);
+    matrix[0] *= scale[0][node];
+    matrix[1] *= scale[1][node];
+    matrix[2] *= scale[2][node];
+    matrix[3] = glm::vec4(translation[0][node], translation[1][node], translation[2][node], 1.0f);
+    return matrix;
+}
+
+void PoseBlend::Blend(LocalPose &pose, const LocalPose &source, float weight, const float *mask){
+    size_t count = pose.GetPaddedSize();
+#ifdef LOCAL_POSE_SSE
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 signBit = _mm_set1_ps(-0.0f);
+    __m128 uniformWeight = _mm_set1_ps(weight);
+    
+    for(size_t i=0; i<count; i+=4){
+        __m128 w = mask ? _mm_mul_ps(uniformWeight, _mm_loadu_ps(mask + i)) : uniformWeight;
+        __m128 keep = _mm_sub_ps(one, w);
+        
+        for(int c=0; c<3; c++){
+            float *t = &pose.translation[c][i];
+            float *s = &pose.scale[c][i];
+            _mm_storeu_ps(t, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(t), keep), _mm_mul_ps(_mm_loadu_ps(&source.translation[c][i]), w)));
+            _mm_storeu_ps(s, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(s), keep), _mm_mul_ps(_mm_loadu_ps(&source.scale[c][i]), w)));
+        }
+        
+        __m128 a[4], b[4];
+        __m128 dot = zero;
+        for(int c=0; c<4; c++){
+            a[c] = _mm_loadu_ps(&pose.rotation[c][i]);
+            b[c] = _mm_loadu_ps(&source.rotation[c][i]);
+            dot = _mm_add_ps(dot, _mm_mul_ps(a[c], b[c]));
+        }
+        
+        // Flip the source weight where the quaternions are in opposite hemispheres
+        __m128 sourceWeight = _mm_xor_ps(w, _mm_and_ps(_mm_cmplt_ps(dot, zero), signBit));
+        __m128 lengthSquared = zero;
+        for(int c=0; c<4; c++){
+            a[c] = _mm_add_ps(_mm_mul_ps(a[c], keep), _mm_mul_ps(b[c], sourceWeight));
+            lengthSquared = _mm_add_ps(lengthSquared, _mm_mul_ps(a[c], a[c]));
+        }
+        __m128 inverseLength = _mm_div_ps(one, _mm_sqrt_ps(lengthSquared));
+        for(int c=0; c<4; c++){
+            _mm_storeu_ps(&pose.rotation[c][i], _mm_mul_ps(a[c], inverseLength));
+        }
+    }
+#else
+    BlendScalar(pose, source, weight, mask, 0, count);
+#endif
+}
+
+void PoseBlend::BlendAdditive(LocalPose &pose, const LocalPose &source, const LocalPose &reference,
+                              float weight, const float *mask){
+    size_t count = pose.GetPaddedSize();
+#ifdef LOCAL_POSE_SSE
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 signBit = _mm_set1_ps(-0.0f);
+    __m128 uniformWeight = _mm_set1_ps(weight);
+    
+    for(size_t i=0; i<count; i+=4){
+        __m128 w = mask ? _mm_mul_ps(uniformWeight, _mm_loadu_ps(mask + i)) : uniformWeight;
+        
+        // t += w * (source - reference), s *= 1 + w * (source / reference - 1)
+        for(int c=0; c<3; c++){
+            float *t = &pose.translation[c][i];
+            float *s = &pose.scale[c][i];
+            __m128 deltaT = _mm_sub_ps(_mm_loadu_ps(&source.translation[c][i]), _mm_loadu_ps(&reference.translation[c][i]));
+            __m128 ratioS = _mm_sub_ps(_mm_div_ps(_mm_loadu_ps(&source.scale[c][i]), _mm_loadu_ps(&reference.scale[c][i])), one);
+            _mm_storeu_ps(t, _mm_add_ps(_mm_loadu_ps(t), _mm_mul_ps(deltaT, w)));
+            _mm_storeu_ps(s, _mm_mul_ps(_mm_loadu_ps(s), _mm_add_ps(one, _mm_mul_ps(ratioS, w))));
+        }
+        
+        // delta = source * conjugate(reference)
+        __m128 sx = _mm_loadu_ps(&source.rotation[0][i]), sy = _mm_loadu_ps(&source.rotation[1][i]);
+        __m128 sz = _mm_loadu_ps(&source.rotation[2][i]), sw = _mm_loadu_ps(&source.rotation[3][i]);
+        __m128 rx = _mm_xor_ps(_mm_loadu_ps(&reference.rotation[0][i]), signBit);
+        __m128 ry = _mm_xor_ps(_mm_loadu_ps(&reference.rotation[1][i]), signBit);
+        __m128 rz = _mm_xor_ps(_mm_loadu_ps(&reference.rotation[2][i]), signBit);
+        __m128 rw = _mm_loadu_ps(&reference.rotation[3][i]);
+        __m128 dw = _mm_sub_ps(_mm_sub_ps(_mm_mul_ps(sw, rw), _mm_mul_ps(sx, rx)), _mm_add_ps(_mm_mul_ps(sy, ry), _mm_mul_ps(sz, rz)));
+        __m128 dx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(sw, rx), _mm_mul_ps(sx, rw)), _mm_sub_ps(_mm_mul_ps(sy, rz), _mm_mul_ps(sz, ry)));
+        __m128 dy = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(sw, ry), _mm_mul_ps(sx, rz)), _mm_add_ps(_mm_mul_ps(sy, rw), _mm_mul_ps(sz, rx)));
+        __m128 dz = _mm_add_ps(_mm_sub_ps(_mm_add_ps(_mm_mul_ps(sw, rz), _mm_mul_ps(sx, ry)), _mm_mul_ps(sy, rx)), _mm_mul_ps(sz, rw));
+        
+        // Scale the delta by nlerp from identity, along the shortest path
+        __m128 flip = _mm_and_ps(_mm_cmplt_ps(dw, zero), signBit);
+        __m128 deltaWeight = _mm_xor_ps(w, flip);
+        __m128 keep = _mm_sub_ps(one, w);
+        dx = _mm_mul_ps(dx, deltaWeight);
+        dy = _mm_mul_ps(dy, deltaWeight);
+        dz = _mm_mul_ps(dz, deltaWeight);
+        dw = _mm_add_ps(keep, _mm_mul_ps(dw, deltaWeight));
+        
+        // pose = delta * pose
+        __m128 px = _mm_loadu_ps(&pose.rotation[0][i]), py = _mm_loadu_ps(&pose.rotation[1][i]);
+        __m128 pz = _mm_loadu_ps(&pose.rotation[2][i]), pw = _mm_loadu_ps(&pose.rotation[3][i]);
+        __m128 qw = _mm_sub_ps(_mm_sub_ps(_mm_mul_ps(dw, pw), _mm_mul_ps(dx, px)), _mm_add_ps(_mm_mul_ps(dy, py), _mm_mul_ps(dz, pz)));
+        __m128 qx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dw, px), _mm_mul_ps(dx, pw)), _mm_sub_ps(_mm_mul_ps(dy, pz), _mm_mul_ps(dz, py)));
+        __m128 qy = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(dw, py), _mm_mul_ps(dx, pz)), _mm_add_ps(_mm_mul_ps(dy, pw), _mm_mul_ps(dz, px)));
+        __m128 qz = _mm_add_ps(_mm_sub_ps(_mm_add_ps(_mm_mul_ps(dw, pz), _mm_mul_ps(dx, py)), _mm_mul_ps(dy, px)), _mm_mul_ps(dz, pw));
+        
+        __m128 lengthSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(qx, qx), _mm_mul_ps(qy, qy)), _mm_add_ps(_mm_mul_ps(qz, qz), _mm_mul_ps(qw, qw)));
+        __m128 inverseLength = _mm_div_ps(one, _mm_sqrt_ps(lengthSquared));
+        _mm_storeu_ps(&pose.rotation[0][i], _mm_mul_ps(qx, inverseLength));
+        _mm_storeu_ps(&pose.rotation[1][i], _mm_mul_ps(qy, inverseLength));
+        _mm_storeu_ps(&pose.rotation[2][i], _mm_mul_ps(qz, inverseLength));
+        _mm_storeu_ps(&pose.rotation[3][i], _mm_mul_ps(qw, inverseLength));
+    }
+#else
+    BlendAdditiveScalar(pose, source, reference, weight, mask, 0, count);
+#endif
+}
+
+void PoseBlend::BlendScalar(LocalPose &pose, const LocalPose &source, float weight, const float *mask, size_t begin, size_t end){
+    for(size_t i=begin; i<end; i++){
+        float w = mask ? weight * mask[i] : weight;
+        for(int c=0; c<3; c++){
+            pose.translation[c][i] += (source.translation[c][i] - pose.translation[c][i]) * w;
+            pose.scale[c][i] += (source.scale[c][i] - pose.scale[c][i]) * w;
+        }
+        
+        float dot = 0.0f;
+        for(int c=0; c<4; c++){
+            dot += pose.rotation[c][i] * source.rotation[c][i];
+        }
+        float sourceWeight = dot < 0.0f ? -w : w;
+        float lengthSquared = 0.0f;
+        for(int c=0; c<4; c++){
+            pose.rotation[c][i] = pose.rotation[c][i] * (1.0f - w) + source.rotation[c][i] * sourceWeight;
+            lengthSquared += pose.rotation[c][i] * pose.rotation[c][i];
+        }
+        float inverseLength = 1.0f / sqrtf(lengthSquared);
+        for(int c=0; c<4; c++){
+            pose.rotation[c][i] *= inverseLength;
+        }
+    }
+}
+
+void PoseBlend::BlendAdditiveScalar(LocalPose &pose, const LocalPose &source, const LocalPose &reference,
+                                    float weight, const float *mask, size_t begin, size_t end){
+    for(size_t i=begin; i<end; i++){
+        float w = mask ? weight * mask[i] : weight;
+        for(int c=0; c<3; c++){
+            pose.translation[c][i] += (source.translation[c][i] - reference.translation[c][i]) * w;
+            pose.scale[c][i] *= 1.0f + (source.scale[c][i] / reference.scale[c][i] - 1.0f) * w;
+        }
+        
+        glm::quat sourceRotation(source.rotation[3][i], source.rotation[0][i], source.rotation[1][i], source.rotation[2][i]);
+        glm::quat referenceRotation(reference.rotation[3][i], reference.rotation[0][i], reference.rotation[1][i], reference.rotation[2][i]);
+        glm::quat poseRotation(pose.rotation[3][i], pose.rotation[0][i], pose.rotation[1][i], pose.rotation[2][i]);
+        
+        glm::quat delta = sourceRotation * glm::conjugate(referenceRotation);
+        float deltaWeight = delta.w < 0.0f ? -w : w;
+        delta = glm::quat(1.0f - w + delta.w * deltaWeight, delta.x * deltaWeight, delta.y * deltaWeight, delta.z * deltaWeight);
+        glm::quat result = glm::normalize(delta * poseRotation);
+        
+        pose.rotation[0][i] = result.x;
+        pose.rotation[1][i] = result.y;
+        pose.rotation[2][i] = result.z;
+        pose.rotation[3][i] = result.w;
+    }
+}
@@ -0,0 +1,50 @@
+//
+//  LocalPose.hpp
+//  ModelLoader
+//
+//  Created by Apple on 19/10/26.
+//
+
+#ifndef LocalPose_hpp
+#define LocalPose_hpp
+
+#include <stdio.h>
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+/* Local space translation, rotation and scale of every skeleton node, one array per
+    component so blends run over 4 nodes at a time. Arrays are padded to a multiple of 4
+    with identity transforms */
+struct LocalPose{
+    std::vector<float> translation[3];
+    std::vector<float> rotation[4];     // x, y, z, w
+    std::vector<float> scale[3];
+    
+    void Resize(size_t nodeCount);
+    size_t GetPaddedSize() const { return translation[0].size(); }
+    
+    void Set(size_t node, const glm::vec3 &position, const glm::quat &orientation, const glm::vec3 &scaling);
+    void Copy(size_t node, const LocalPose &source);
+    glm::mat4 GetMatrix(size_t node) const;
+};
+
+/* Blend operations between two poses of the same skeleton. weight is scaled per node by
+    mask when one is given, the mask must cover the padded size of the poses */
+class PoseBlend{
+public:
+    /* pose = mix(pose, source, weight). Rotations take the shortest path and are
+        renormalised (nlerp) */
+    static void Blend(LocalPose &pose, const LocalPose &source, float weight, const float *mask);
+    
+    /* Adds the difference between source and reference on top of pose, so a clip authored
+        as an offset (breathing, aiming) plays over whatever pose is underneath */
+    static void BlendAdditive(LocalPose &pose, const LocalPose &source, const LocalPose &reference,
+                              float weight, const float *mask);
+    
+private:
+    static void BlendScalar(LocalPose &pose, const LocalPose &source, float weight, const float *mask, size_t begin, size_t end);
+    static void BlendAdditiveScalar(LocalPose &pose, const LocalPose &source, const LocalPose &reference,
+                                    float weight, const float *mask, size_t begin, size_t end);
+};
+#endif /* LocalPose_hpp */
@@ -9,19 +9,124 @@
 
 Mesh::Mesh(std::vector<Vertex>  vertices,
      std::vector<unsigned int> indices,
-           std::vector<Texture> textures){
+           std::vector<Texture> textures,
+           bool uploadToGPU,
+           std::vector<int> paletteBones,
+           MorphTargets morphTargets){
     this->vertices = vertices;
     this->indices = indices;
     this->textures = textures;
+    this->paletteBones = paletteBones;
+    this->morphTargets = morphTargets;
+    splitRigidSections();
+    countInfluences();
     
     // Prepare mesh with the captured data to use for rendering
-    setupMesh();
+    if(uploadToGPU){
+        setupMesh();
+        this->morphTargets.Upload((unsigned int)this->vertices.size());
+    }
 }
 
 Mesh::~Mesh(){
     
 }
 
+void Mesh::splitRigidSections(){
+    // Bone a vertex follows rigidly, -1 if it blends several bones or none
+    std::vector<int> rigidBones(vertices.size(), -1);
+    for(size_t i=0; i<vertices.size(); i++){
+        int boneId = -1;
+        int influenceCount = 0;
+        for(int j=0; j<MAX_BONE_INFLUENCE; j++){
+            if(vertices[i].mBoneIds[j] >= 0 && vertices[i].mWeights[j] > 0.0f){
+                boneId = vertices[i].mBoneIds[j];
+                influenceCount++;
+            }
+        }
+        // Slots past MAX_PALETTE_BONES keep the bind pose in the skinning shaders, not in drawRigid
+        if(influenceCount == 1 && boneId < MAX_PALETTE_BONES){
+            rigidBones[i] = boneId;
+        }
+    }
+    
+    // Vertices a blend shape moves have to go through the skinning shader
+    const std::vector<MorphDelta> &morphDeltas = morphTargets.GetDeltas();
+    for(size_t i=0; i<morphDeltas.size(); i++){
+        rigidBones[morphDeltas[i].vertex] = -1;
+    }
+    
+    // A triangle is rigid when its 3 vertices follow the same bone
+    std::vector<unsigned int> deformableIndices;
+    std::vector<std::pair<int, unsigned int>> rigidTriangles;   // Bone id, first index in indices
+    std::vector<bool> deformableVertices(vertices.size(), false);
+    for(size_t i=0; i+2<indices.size(); i+=3){
+        int boneId = rigidBones[indices[i]];
+        if(boneId >= 0 && rigidBones[indices[i + 1]] == boneId && rigidBones[indices[i + 2]] == boneId){
+            rigidTriangles.push_back(std::make_pair(boneId, (unsigned int)i));
+        }else{
+            for(int k=0; k<3; k++){
+                deformableIndices.push_back(indices[i + k]);
+                deformableVertices[indices[i + k]] = true;
+            }
+        }
+    }
+    
+    // Grouped by bone so each section is a single draw
+    std::stable_sort(rigidTriangles.begin(), rigidTriangles.end(),
+                     [](const std::pair<int, unsigned int> &a, const std::pair<int, unsigned int> &b){ return a.first < b.first; });
+    
+    deformableIndexCount = (unsigned int)deformableIndices.size();
+    rigidSections.clear();
+    std::vector<unsigned int> splitIndices = deformableIndices;
+    for(size_t i=0; i<rigidTriangles.size(); i++){
+        if(rigidSections.empty() || rigidSections.back().boneId != rigidTriangles[i].first){
+            RigidSection section;
+            section.boneId = rigidTriangles[i].first;
+            section.firstIndex = (unsigned int)splitIndices.size();
+            section.indexCount = 0;
+            rigidSections.push_back(section);
+        }
+        for(int k=0; k<3; k++){
+            splitIndices.push_back(indices[rigidTriangles[i].second + k]);
+        }
+        rigidSections.back().indexCount += 3;
+    }
+    indices.swap(splitIndices);
+    
+    std::vector<bool> rigidVertices(vertices.size(), false);
+    for(size_t i=deformableIndexCount; i<indices.size(); i++){
+        rigidVertices[indices[i]] = true;
+    }
+    rigidVertexCount = 0;
+    for(size_t i=0; i<vertices.size(); i++){
+        if(rigidVertices[i] && !deformableVertices[i]){
+            rigidVertexCount++;
+        }
+    }
+}
+
+void Mesh::countInfluences(){
+    // Only the deformable triangles go through the skinning shader
+    int maxInfluences = 0;
+    for(unsigned int i=0; i<deformableIndexCount; i++){
+        const Vertex &vertex = vertices[indices[i]];
+        int count = 0;
+        while(count < MAX_BONE_INFLUENCE && vertex.mBoneIds[count] >= 0){
+            count++;
+        }
+        maxInfluences = std::max(maxInfluences, count);
+    }
+    
+    influenceCount = 0;
+    for(int i=0; i<INFLUENCE_BUCKET_COUNT && maxInfluences > 0; i++){
+        if(INFLUENCE_BUCKETS[i] >= maxInfluences){
+            influenceCount = INFLUENCE_BUCKETS[i];
+            break;
+        }
+    }
+}
+
 void Mesh::setupMesh(){
     // Setup VAO, VBO, EBO
     // -- VAO
@@ -34,7 +139,7 @@ void Mesh::setupMesh(){
     glGenBuffers(1, &EBO);
     
     // Activate VAO, VBO, EBO to pass the data to VBO, EBO
-    glBindVertexArray(VAO);
+    GLState::BindVertexArray(VAO);
     glBindBuffer(GL_ARRAY_BUFFER, VBO);
     glBufferData(GL_ARRAY_BUFFER,
                  vertices.size() * sizeof(Vertex),  // Size of data to be passed
@@ -85,39 +190,180 @@ void Mesh::setupMesh(){
     
     // -- Bone Ids
     // Notice the usage of glVertexAttribIPointer for bone ids
-    glEnableVertexAttribArray(3);
-    glVertexAttribIPointer(
-                          3,                // Position of the vertex attribute
-                          4,                // Number of values to take for each vertex
-                          GL_INT,           // Datatype of values
-                          sizeof(Vertex),   // Location of next vertex attribute data
-                          (void *) offsetof(Vertex, mBoneIds)       // Start position of the vertex attribute data
-                          );
+    // Influences 1 to 4 go to locations 3 and 4, influences 5 to 8 to locations 5 and 6
+    for(unsigned int half=0; half<MAX_BONE_INFLUENCE/4; half++){
+        glEnableVertexAttribArray(3 + half * 2);
+        glVertexAttribIPointer(
+                              3 + half * 2,     // Position of the vertex attribute
+                              4,                // Number of values to take for each vertex
+                              GL_INT,           // Datatype of values
+                              sizeof(Vertex),   // Location of next vertex attribute data
+                              (void *) (offsetof(Vertex, mBoneIds) + half * 4 * sizeof(int))       // Start position of the vertex attribute data
+                              );
+        
+        // -- Weights
+        glEnableVertexAttribArray(4 + half * 2);
+        glVertexAttribPointer(
+                              4 + half * 2,     // Position of the vertex attribute
+                              4,                // Number of values to take for each vertex
+                              GL_FLOAT,         // Datatype of values
+                              GL_FALSE,         // Normalization not necessary
+                              sizeof(Vertex),   // Location of next vertex attribute data
+                              (void *) (offsetof(Vertex, mWeights) + half * 4 * sizeof(float))     // Start position of the vertex attribute data
+                              );
+    }
+    
+    // Unbind
+    //glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    GLState::BindVertexArray(0);
+}
+
+void Mesh::setupInstanceAttributes(unsigned int instanceVBO){
+    GLState::BindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
     
-    // -- Weights
-    glEnableVertexAttribArray(4);
+    // -- Model matrix, a mat4 attribute takes 4 consecutive locations, one per column
+    for(unsigned int column=0; column<4; column++){
+        glEnableVertexAttribArray(8 + column);
+        glVertexAttribPointer(
+                              8 + column,           // Position of the vertex attribute
+                              4,                    // Number of values to take for each instance
+                              GL_FLOAT,             // Datatype of values
+                              GL_FALSE,             // Normalization not necessary
+                              sizeof(InstanceData), // Location of next instance attribute data
+                              (void *) (offsetof(InstanceData, model) + column * sizeof(glm::vec4))
+                              );
+        glVertexAttribDivisor(8 + column, 1);       // Advance once per instance instead of per vertex
+    }
+    
+    // -- Clip index and time offset
+    glEnableVertexAttribArray(12);
     glVertexAttribPointer(
-                          4,                // Position of the vertex attribute
-                          4,                // Number of values to take for each vertex
-                          GL_INT,           // Datatype of values
-                          GL_FALSE,         // Normalization not necessary
-                          sizeof(Vertex),   // Location of next vertex attribute data
-                          (void *) offsetof(Vertex, mWeights)       // Start position of the vertex attribute data
+                          12,                   // Position of the vertex attribute
+                          2,                    // Number of values to take for each instance
+                          GL_FLOAT,             // Datatype of values
+                          GL_FALSE,             // Normalization not necessary
+                          sizeof(InstanceData), // Location of next instance attribute data
+                          (void *) offsetof(InstanceData, animation)
                           );
+    glVertexAttribDivisor(12, 1);
     
-    // Unbind
-    //glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBindVertexArray(0);
+    GLState::BindVertexArray(0);
 }
 
-void Mesh::draw(Shader &shader){
+void Mesh::setupSkinnedOutput(){
+    glGenVertexArrays(1, &skinnedVAO);
+    glGenBuffers(1, &skinnedVBO);
+    
+    glBindBuffer(GL_ARRAY_BUFFER, skinnedVBO);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(SkinnedOutput), NULL, GL_DYNAMIC_COPY);
+    
+    GLState::BindVertexArray(skinnedVAO);
+    
+    // -- Skinned Position and Normal
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(SkinnedOutput), (void *) offsetof(SkinnedOutput, position));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(SkinnedOutput), (void *) offsetof(SkinnedOutput, normal));
+    
+    // -- Texture Coordinate and indices don't change, read them from the mesh's own buffers
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *) offsetof(Vertex, texCoords));
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+    
+    GLState::BindVertexArray(0);
+}
+
+void Mesh::skin(){
+    if(skinnedVAO == 0){
+        setupSkinnedOutput();
+    }
+    
+    // One point per vertex, the index buffer is not needed to skin each vertex once
+    GLState::BindVertexArray(VAO);
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, skinnedVBO);
+    glBeginTransformFeedback(GL_POINTS);
+    glDrawArrays(GL_POINTS, 0, (GLsizei)vertices.size());
+    glEndTransformFeedback();
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+}
+
+void Mesh::drawSkinned(Shader &shader){
+    bindTextures(shader);
+    
+    GLState::BindVertexArray(skinnedVAO);
+    glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+}
+
+void Mesh::drawDeformable(Shader &shader){
+    if(deformableIndexCount == 0){
+        return;
+    }
+    bindTextures(shader);
+    morphTargets.Bind(shader);
+    
+    GLState::BindVertexArray(VAO);
+    glDrawElements(GL_TRIANGLES, deformableIndexCount, GL_UNSIGNED_INT, 0);
+}
+
+void Mesh::drawRigid(Shader &shader, const std::vector<glm::mat4> &palette, const glm::mat4 &model){
+    if(rigidSections.empty()){
+        return;
+    }
+    bindTextures(shader);
+    
+    GLState::BindVertexArray(VAO);
+    for(size_t i=0; i<rigidSections.size(); i++){
+        const RigidSection &section = rigidSections[i];
+        int boneId = paletteBones[section.boneId];
+        assert(boneId < (int)palette.size());
+        shader.setMatrix4("model", boneId < (int)palette.size() ? model * palette[boneId] : model);
+        glDrawElements(GL_TRIANGLES, section.indexCount, GL_UNSIGNED_INT, (void *) (section.firstIndex * sizeof(unsigned int)));
+    }
+}
+
+void Mesh::gatherPalette(const std::vector<glm::mat4> &palette, std::vector<glm::mat4> &meshPalette) const{
+    // A palette smaller than the skeleton is a caller bug, its missing bones keep the bind pose
+    meshPalette.resize(paletteBones.size());
+    for(size_t i=0; i<paletteBones.size(); i++){
+        assert(paletteBones[i] < (int)palette.size());
+        meshPalette[i] = paletteBones[i] < (int)palette.size() ? palette[paletteBones[i]] : glm::mat4(1.0f);
+    }
+}
+
+void Mesh::uploadPalettes(Shader &shader, const PaletteSet &palettes){
+    if(paletteBones.empty()){
+        return;
+    }
+    
+    if(palettes.boneMatrices){
+        gatherPalette(*palettes.boneMatrices, paletteScratch);
+        shader.setMatrix4Array("finalBonesMatrices", &paletteScratch[0], std::min((int)paletteScratch.size(), MAX_PALETTE_BONES));
+    }
+    if(palettes.previousBoneMatrices){
+        gatherPalette(*palettes.previousBoneMatrices, paletteScratch);
+        shader.setMatrix4Array("previousBonesMatrices", &paletteScratch[0], std::min((int)paletteScratch.size(), MAX_PALETTE_BONES));
+    }
+    if(palettes.boneDualQuaternions){
+        const std::vector<glm::vec4> &dualQuaternions = *palettes.boneDualQuaternions;
+        dualQuaternionScratch.resize(paletteBones.size() * 2);
+        for(size_t i=0; i<paletteBones.size(); i++){
+            int boneId = paletteBones[i];
+            assert(boneId * 2 + 1 < (int)dualQuaternions.size());
+            bool inPalette = boneId * 2 + 1 < (int)dualQuaternions.size();
+            dualQuaternionScratch[i * 2 + 0] = inPalette ? dualQuaternions[boneId * 2 + 0] : glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+            dualQuaternionScratch[i * 2 + 1] = inPalette ? dualQuaternions[boneId * 2 + 1] : glm::vec4(0.0f);
+        }
+        shader.setVector4fArray("finalBonesDualQuats", &dualQuaternionScratch[0], std::min((int)dualQuaternionScratch.size(), MAX_PALETTE_BONES * 2));
+    }
+}
+
+void Mesh::bindTextures(Shader &shader){
     unsigned int diffuseNr = 1;
     unsigned int specularNr = 1;
     
     for(unsigned int i=0; i<textures.size(); i++){
-        // Activate proper texture unit before binding
-        glActiveTexture(GL_TEXTURE0 + i);
-        
         // Retrieve texture number ( the N in texture_diffuseN) to calculate the uniform name
         std::string number;
         std::string name = textures[i].type;
@@ -128,14 +374,27 @@ void Mesh::draw(Shader &shader){
         }
         
         shader.setFloat(("material."+name+number).c_str(), i);
-        glBindTexture(GL_TEXTURE_2D, textures[i].id);
+        GLState::BindTextureUnit(i, GL_TEXTURE_2D, textures[i].id);
     }
-    
-    // Reset Active Texture
-    glActiveTexture(GL_TEXTURE_2D);
+}
+
+void Mesh::draw(Shader &shader){
+    bindTextures(shader);
     
     // Draw Mesh
-    glBindVertexArray(this->VAO);
+    GLState::BindVertexArray(this->VAO);
     glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-    glBindVertexArray(0);
+}
+
+void Mesh::drawInstanced(Shader &shader, unsigned int instanceCount){
+    bindTextures(shader);
+    
+    // Crowd palettes hold every bone of the skeleton, map this mesh's slots to them
+    if(!paletteBones.empty()){
+        shader.setIntegerArray("paletteBones", &paletteBones[0], (int)paletteBones.size());
+    }
+    
+    // Draw every instance of the mesh in one call
+    GLState::BindVertexArray(this->VAO);
+    glDrawElementsInstanced(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0, instanceCount);
 }
@@ -13,10 +13,24 @@
 #include <GL/glew.h>
 #include <glm/glm.hpp>
 #include <vector>
+#include <algorithm>
+#include <utility>
+#include <cassert>
 
 #include "Shader.hpp"
+#include "MorphTargets.hpp"
 
-#define MAX_BONE_INFLUENCE 4
+#define MAX_BONE_INFLUENCE 8
+// Influences lighter than this are dropped at load, the rest renormalised
+#define MIN_BONE_WEIGHT (1.0f / 255.0f)
+
+// Bones a single draw can reference, MAX_BONES in the skinning shaders. Larger rigs are split
+// at load so that no mesh references more
+#define MAX_PALETTE_BONES 100
+
+// Influence counts the skinning shaders are compiled for, a mesh uses the smallest that fits
+#define INFLUENCE_BUCKET_COUNT 4
+static const int INFLUENCE_BUCKETS[INFLUENCE_BUCKET_COUNT] = { 1, 2, 4, 8 };
 
 struct Vertex{
     glm::vec3 position;
@@ -25,13 +39,42 @@ struct Vertex{
     //glm::vec3 tangent;
     //glm::vec3 bitangent;
     
-    // Bone indices which will influence this vertex
+    // Bone indices which will influence this vertex, heaviest first and -1 past the last.
+    // They index the mesh's palette, see Mesh::paletteBones
     int mBoneIds[MAX_BONE_INFLUENCE];
     
-    // Weight from each bone
+    // Weight from each bone, summing to 1
     float mWeights[MAX_BONE_INFLUENCE];
 };
 
+// Vertex written by the transform feedback skinning pass, see skinning_feedback.vs
+struct SkinnedOutput{
+    glm::vec3 position;
+    glm::vec3 normal;
+};
+
+// Per instance attributes of an instanced draw
+struct InstanceData{
+    glm::mat4 model;
+    glm::vec2 animation;    // x = baked clip index, y = time offset in seconds
+};
+
+/* Run of triangles whose vertices all follow one bone with full weight, drawn without
+    skinning using that bone's palette matrix as part of the model transform */
+struct RigidSection{
+    int boneId;             // Palette slot, see Mesh::paletteBones
+    unsigned int firstIndex;
+    unsigned int indexCount;
+};
+
+/* Model wide palettes of a skinned draw, indexed by skeleton bone id. Each mesh uploads
+    only the bones it references, in its own order. Unused palettes stay null */
+struct PaletteSet{
+    const std::vector<glm::mat4> *boneMatrices = nullptr;          // finalBonesMatrices
+    const std::vector<glm::mat4> *previousBoneMatrices = nullptr;  // previousBonesMatrices, mesh.vs with PALETTE_BLEND
+    const std::vector<glm::vec4> *boneDualQuaternions = nullptr;   // finalBonesDualQuats, 2 per bone, mesh.vs with DUAL_QUATERNION
+};
+
 struct Texture{
     unsigned int id;
     std::string type;
@@ -45,23 +88,71 @@ public:
     std::vector<Vertex>  vertices;
     std::vector<unsigned int> indices;
     std::vector<Texture> textures;
+    // Skeleton bone id of each palette slot the vertices reference, at most MAX_PALETTE_BONES
+    std::vector<int> paletteBones;
+    // Blend shapes, applied before skinning
+    MorphTargets morphTargets;
+    
+    // -- Rigid split, the index buffer holds the deformable triangles first then one run per rigid section
+    unsigned int deformableIndexCount = 0;
+    std::vector<RigidSection> rigidSections;
+    unsigned int rigidVertexCount = 0;      // Vertices only rigid sections use, so no vertex shader skins them
+    int influenceCount = 0;                 // Bucket of the deformable triangles, 0 if nothing is skinned
     
     // Behaviors
     // -- Constructors and Destructors
+    // uploadToGPU = false keeps the data on the CPU only, no GL context is needed then
     Mesh(std::vector<Vertex>  vertices,
          std::vector<unsigned int> indices,
-         std::vector<Texture> textures);
+         std::vector<Texture> textures,
+         bool uploadToGPU = true,
+         std::vector<int> paletteBones = std::vector<int>(),
+         MorphTargets morphTargets = MorphTargets());
     ~Mesh();
     
     // -- Render Functions
     void draw(Shader &shader);
+    void drawInstanced(Shader &shader, unsigned int instanceCount);
+    
+    /* Draws only the triangles that need skinning, with a skinning shader */
+    void drawDeformable(Shader &shader);
+    
+    /* Uploads the bones this mesh references from each palette of the set to the bound
+        skinning shader, a few matrices per draw instead of the whole skeleton */
+    void uploadPalettes(Shader &shader, const PaletteSet &palettes);
+    
+    /* Copies the entries of a model wide palette this mesh references, in slot order,
+        e.g. for CpuSkinning of this mesh's vertices */
+    void gatherPalette(const std::vector<glm::mat4> &palette, std::vector<glm::mat4> &meshPalette) const;
+    /* Draws the rigid sections with a static shader such as mesh.vs without features, setting its
+        model uniform to model * palette[paletteBones[boneId]] for each section */
+    void drawRigid(Shader &shader, const std::vector<glm::mat4> &palette, const glm::mat4 &model);
+    
+    /* Points the instance attributes (locations 8 to 12) of this mesh's VAO at
+        instanceVBO, which holds tightly packed InstanceData */
+    void setupInstanceAttributes(unsigned int instanceVBO);
+    
+    /* Runs the bound transform feedback program over every vertex and keeps the result
+        in a second vertex buffer. Call with GL_RASTERIZER_DISCARD enabled */
+    void skin();
+    
+    /* Draws the vertices written by the last skin() with a static shader such as
+        mesh.vs without features, as many times as needed without skinning again */
+    void drawSkinned(Shader &shader);
     
 private:
     // Properties
     // -- Render data
-    unsigned int VAO, VBO, EBO;
+    unsigned int VAO = 0, VBO = 0, EBO = 0;
+    unsigned int skinnedVAO = 0, skinnedVBO = 0;    // Output of the skinning pass, created on first use
+    std::vector<glm::mat4> paletteScratch;
+    std::vector<glm::vec4> dualQuaternionScratch;
     
     // Behaviors
     void setupMesh();
+    void splitRigidSections();
+    void countInfluences();
+    void setupSkinnedOutput();
+    void bindTextures(Shader &shader);
 };
 #endif /* Mesh_hpp */
@@ -10,7 +10,7 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
-Model::Model(char *path, bool gamma): gammaCorrection(gamma){
+Model::Model(char *path, bool gamma, bool headless): gammaCorrection(gamma), headless(headless){
     
     // tell stb_image.h to flip loaded texture's on the y-axis (before loading model).
     //stbi_set_flip_vertically_on_load(true);
@@ -27,11 +27,103 @@ void Model::draw(Shader &shader){
     }
 }
 
+void Model::drawInstanced(Shader &shader, const std::vector<InstanceData> &instances){
+    if(instances.empty()){
+        return;
+    }
+    
+    // Instance buffer is created on first use and wired into every mesh VAO once
+    if(instanceVBO == 0){
+        glGenBuffers(1, &instanceVBO);
+        for(unsigned int i=0; i<meshes.size(); i++){
+            meshes[i].setupInstanceAttributes(instanceVBO);
+        }
+    }
+    
+    // Orphan the previous contents so the driver doesn't wait on last frame's draws
+    glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+    glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(InstanceData), NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, instances.size() * sizeof(InstanceData), &instances[0]);
+    
+    for(unsigned int i=0; i<meshes.size(); i++){
+        meshes[i].drawInstanced(shader, (unsigned int)instances.size());
+    }
+}
+
+void Model::skin(Shader &feedbackShader, const PaletteSet &palettes){
+    feedbackShader.use();
+    
+    // Only the captured vertices are wanted, nothing reaches the rasterizer
+    glEnable(GL_RASTERIZER_DISCARD);
+    for(unsigned int i=0; i<meshes.size(); i++){
+        meshes[i].uploadPalettes(feedbackShader, palettes);
+        meshes[i].skin();
+    }
+    glDisable(GL_RASTERIZER_DISCARD);
+}
+
+void Model::drawSkinned(Shader &shader){
+    for(unsigned int i=0; i<meshes.size(); i++){
+        meshes[i].drawSkinned(shader);
+    }
+}
+
+void Model::drawDeformable(Shader &skinningShader, const PaletteSet &palettes, int influenceCount){
+    for(unsigned int i=0; i<meshes.size(); i++){
+        if(meshes[i].deformableIndexCount > 0 && (influenceCount == 0 || meshes[i].influenceCount == influenceCount)){
+            meshes[i].uploadPalettes(skinningShader, palettes);
+            meshes[i].drawDeformable(skinningShader);
+        }
+    }
+}
+
+bool Model::HasMorphTargets() const{
+    for(unsigned int i=0; i<meshes.size(); i++){
+        if(!meshes[i].morphTargets.IsEmpty()){
+            return true;
+        }
+    }
+    return false;
+}
+
+void Model::SetMorphWeight(const std::string &name, float weight){
+    for(unsigned int i=0; i<meshes.size(); i++){
+        int target = meshes[i].morphTargets.FindTarget(name);
+        if(target >= 0){
+            meshes[i].morphTargets.SetWeight(target, weight);
+        }
+    }
+}
+
+void Model::applyMorphTargets(Shader &scatterShader){
+    for(unsigned int i=0; i<meshes.size(); i++){
+        meshes[i].morphTargets.Apply(scatterShader);
+    }
+}
+
+bool Model::HasInfluenceBucket(int influenceCount) const{
+    for(unsigned int i=0; i<meshes.size(); i++){
+        if(meshes[i].influenceCount == influenceCount){
+            return true;
+        }
+    }
+    return false;
+}
+
+void Model::drawRigid(Shader &rigidShader, const std::vector<glm::mat4> &palette, const glm::mat4 &model){
+    rigidShader.use();
+    for(unsigned int i=0; i<meshes.size(); i++){
+        meshes[i].drawRigid(rigidShader, palette, model);
+    }
+}
+
 void Model::loadModel(std::string path){
     LOGGER("Loading model: "+path);
     // Load all the mesh data using assimp importer
     Assimp::Importer importer;
-    const aiScene *scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
+    // Meshes referencing more bones than a draw can take are split, see MAX_PALETTE_BONES
+    importer.SetPropertyInteger(AI_CONFIG_PP_SBBC_MAX_BONES, MAX_PALETTE_BONES);
+    const aiScene *scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs | aiProcess_SplitByBoneCount);
     
     if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode){
         const char* errorStr = importer.GetErrorString();
@@ -41,7 +133,23 @@ void Model::loadModel(std::string path){
     // Extract the model directory which we will need later while loading texture
     directory = path.substr(0, path.find_last_of('/'));
     
+    // Bones are registered while the meshes are read, the hierarchy is added after
+    mSkeleton = std::make_shared<Skeleton>();
     processNode(scene->mRootNode, scene);
+    readSkeletonNodes(scene->mRootNode, -1);
+    mSkeleton->Finalize();
+    
+    if(mSkeleton->GetBoneCount() > 0){
+        size_t vertexCount = 0, rigidVertexCount = 0, rigidSectionCount = 0;
+        for(unsigned int i=0; i<meshes.size(); i++){
+            vertexCount += meshes[i].vertices.size();
+            rigidVertexCount += meshes[i].rigidVertexCount;
+            rigidSectionCount += meshes[i].rigidSections.size();
+        }
+        float rigidFraction = vertexCount > 0 ? (float)rigidVertexCount / vertexCount : 0.0f;
+        LOGGER("Rigid sections: "+std::to_string(rigidSectionCount)+", "+std::to_string(rigidVertexCount)+" of "
+               +std::to_string(vertexCount)+" vertices ("+std::to_string(rigidFraction * 100.0f)+"%) skip skinning");
+    }
 }
 
 void Model::processNode(aiNode *node, const aiScene *scene){
@@ -119,8 +227,8 @@ Mesh Model::processMesh(aiMesh *mesh, const aiScene *scene){
             indices.push_back(face.mIndices[j]);
     }
     
-    // Process Materials
-    if(mesh->mMaterialIndex >= 0){
+    // Process Materials, textures are only needed to render
+    if(!headless && mesh->mMaterialIndex >= 0){
         aiMaterial *material = scene->mMaterials[mesh->mMaterialIndex];
         
         // 1. diffuse maps
@@ -143,8 +251,10 @@ Mesh Model::processMesh(aiMesh *mesh, const aiScene *scene){
         
     }
     
-    extractBoneWeightForVertices(vertices, mesh, scene);
-    return Mesh(vertices, indices, textures);
+    std::vector<int> paletteBones;
+    extractBoneWeightForVertices(vertices, paletteBones, mesh, scene);
+    normalizeBoneWeights(vertices);
+    return Mesh(vertices, indices, textures, !headless, paletteBones, extractMorphTargets(vertices, mesh));
 }
 
 std::vector<Texture> Model::loadMaterialTextures(aiMaterial *mat, aiTextureType type, std::string typeName){
@@ -194,7 +304,7 @@ unsigned int Model::textureFromFile(std::string filename, std::string &directory
         else if (nrComponents == 4)
             format = GL_RGBA;
         
-        glBindTexture(GL_TEXTURE_2D, textureId);
+        GLState::BindTexture(GL_TEXTURE_2D, textureId);
        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
        glGenerateMipmap(GL_TEXTURE_2D);
 
@@ -218,40 +328,123 @@ void Model::setVertexBoneDataToDefault(Vertex &vertex){
     }
 }
 
-void Model::extractBoneWeightForVertices(std::vector<Vertex> &vertices, aiMesh *mesh, const aiScene *scene){
+void Model::extractBoneWeightForVertices(std::vector<Vertex> &vertices, std::vector<int> &paletteBones, aiMesh *mesh, const aiScene *scene){
+    if(mesh->mNumBones > MAX_PALETTE_BONES){
+        LOGGER("Mesh "+std::string(mesh->mName.C_Str())+" references "+std::to_string(mesh->mNumBones)+" bones, more than "
+               +std::to_string(MAX_PALETTE_BONES)+" could not be split off. Vertices of the extra bones keep their bind pose");
+    }
+    
+    // The mesh's bones become its palette slots, in the order assimp lists them
     for(int boneIndex=0; boneIndex < mesh->mNumBones; boneIndex++){
-        int boneId = -1;
-        std::string boneName = mesh->mBones[boneIndex]->mName.C_Str();
-        if(mBoneInfoMap.find(boneName) == mBoneInfoMap.end()){
-            BoneInfo newBoneInfo;
-            newBoneInfo.id = mBoneCounter;
-            newBoneInfo.offset = AssimpGLMHelpers::ConvertMatrixToGLMFormat(mesh->mBones[boneIndex]->mOffsetMatrix);
-            mBoneInfoMap[boneName] = newBoneInfo;
-            boneId = mBoneCounter;
-            mBoneCounter++;
-        }else{
-            boneId = mBoneInfoMap[boneName].id;
-        }
+        const aiBone *bone = mesh->mBones[boneIndex];
+        int boneId = mSkeleton->AddBone(bone->mName.C_Str(), AssimpGLMHelpers::ConvertMatrixToGLMFormat(bone->mOffsetMatrix));
         
         assert(boneId != -1);
+        int paletteSlot = (int)paletteBones.size();
+        paletteBones.push_back(boneId);
         
-        auto weights = mesh->mBones[boneIndex]->mWeights;
-        int numWeight = mesh->mBones[boneIndex]->mNumWeights;
+        auto weights = bone->mWeights;
+        int numWeight = bone->mNumWeights;
         for(int weightIndex = 0; weightIndex<numWeight; weightIndex++){
             int vertexId = weights[weightIndex].mVertexId;
             float weight = weights[weightIndex].mWeight;
             assert(vertexId <= vertices.size());
-            setVertexBoneData(vertices[vertexId], boneId, weight);
+            setVertexBoneData(vertices[vertexId], paletteSlot, weight);
+            mSkeleton->AddSkinWeight(boneId, weight, vertices[vertexId].position);
+        }
+    }
+}
+
+MorphTargets Model::extractMorphTargets(const std::vector<Vertex> &vertices, aiMesh *mesh){
+    MorphTargets morphTargets;
+    for(unsigned int i=0; i<mesh->mNumAnimMeshes; i++){
+        // Assimp stores each shape as whole replacement vertices
+        const aiAnimMesh *shape = mesh->mAnimMeshes[i];
+        std::vector<MorphDelta> deltas;
+        unsigned int vertexCount = std::min(shape->mNumVertices, (unsigned int)vertices.size());
+        for(unsigned int v=0; v<vertexCount; v++){
+            MorphDelta delta;
+            delta.vertex = v;
+            delta.position = glm::vec3(0.0f);
+            delta.normal = glm::vec3(0.0f);
+            if(shape->HasPositions()){
+                delta.position = glm::vec3(shape->mVertices[v].x, shape->mVertices[v].y, shape->mVertices[v].z) - vertices[v].position;
+            }
+            if(shape->HasNormals()){
+                delta.normal = glm::vec3(shape->mNormals[v].x, shape->mNormals[v].y, shape->mNormals[v].z) - vertices[v].normal;
+            }
+            if(glm::length(delta.position) > MORPH_DELTA_EPSILON || glm::length(delta.normal) > MORPH_DELTA_EPSILON){
+                deltas.push_back(delta);
+            }
         }
+        
+        std::string name = shape->mName.length > 0 ? std::string(shape->mName.C_Str()) : std::string(mesh->mName.C_Str())+"."+std::to_string(i);
+        morphTargets.AddTarget(name, deltas);
+    }
+    return morphTargets;
+}
+
+void Model::readSkeletonNodes(const aiNode *node, int parent){
+    int index = mSkeleton->AddNode(node->mName.C_Str(), parent, AssimpGLMHelpers::ConvertMatrixToGLMFormat(node->mTransformation));
+    for(unsigned int i=0; i<node->mNumChildren; i++){
+        readSkeletonNodes(node->mChildren[i], index);
     }
 }
 
 void Model::setVertexBoneData(Vertex &vertex, int boneId, float weight){
+    // Fill a free slot, or replace the lightest influence when all are taken
+    int slot = 0;
     for(int i=0; i<MAX_BONE_INFLUENCE; i++){
         if(vertex.mBoneIds[i] < 0){
-            vertex.mWeights[i] = weight;
-            vertex.mBoneIds[i] = boneId;
+            slot = i;
             break;
         }
+        if(vertex.mWeights[i] < vertex.mWeights[slot]){
+            slot = i;
+        }
+    }
+    if(vertex.mBoneIds[slot] >= 0 && vertex.mWeights[slot] >= weight){
+        return;
+    }
+    vertex.mWeights[slot] = weight;
+    vertex.mBoneIds[slot] = boneId;
+}
+
+void Model::normalizeBoneWeights(std::vector<Vertex> &vertices){
+    size_t prunedCount = 0;
+    for(size_t v=0; v<vertices.size(); v++){
+        Vertex &vertex = vertices[v];
+        
+        // Heaviest first, so a shader reading fewer slots keeps the influences that matter
+        std::pair<float, int> influences[MAX_BONE_INFLUENCE];
+        int influenceCount = 0;
+        float totalWeight = 0.0f;
+        for(int i=0; i<MAX_BONE_INFLUENCE; i++){
+            if(vertex.mBoneIds[i] >= 0){
+                influences[influenceCount++] = std::make_pair(vertex.mWeights[i], vertex.mBoneIds[i]);
+            }
+        }
+        std::sort(influences, influences + influenceCount,
+                  [](const std::pair<float, int> &a, const std::pair<float, int> &b){ return a.first > b.first; });
+        
+        // Drop influences too light to move the vertex, always keeping the heaviest
+        int keptCount = std::min(influenceCount, 1);
+        while(keptCount < influenceCount && influences[keptCount].first >= MIN_BONE_WEIGHT){
+            keptCount++;
+        }
+        prunedCount += influenceCount - keptCount;
+        for(int i=0; i<keptCount; i++){
+            totalWeight += influences[i].first;
+        }
+        
+        setVertexBoneDataToDefault(vertex);
+        for(int i=0; i<keptCount; i++){
+            vertex.mBoneIds[i] = influences[i].second;
+            vertex.mWeights[i] = totalWeight > 0.0f ? influences[i].first / totalWeight : 1.0f / keptCount;
+        }
+    }
+    
+    if(prunedCount > 0){
+        LOGGER("Pruned "+std::to_string(prunedCount)+" bone influences below "+std::to_string(MIN_BONE_WEIGHT));
     }
 }
@@ -14,45 +14,79 @@
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
+#include <assimp/config.h>
 #include <map>
 #include <vector>
+#include <memory>
 
 #include "Shader.hpp"
 #include "Mesh.hpp"
+#include "Skeleton.hpp"
 #include "assimp_glm_helper.h"
 
-struct BoneInfo{
-    int id;             // Index in finalBoneMatrices
-    glm::mat4 offset;   // offset matrix transforms vertex from model space to bone space
+// How the bone palette is blended in the vertex shader
+enum SkinningMode{
+    SKINNING_LINEAR,            // mat4 per bone, mesh.vs with SKINNED
+    SKINNING_DUAL_QUATERNION    // 2 vec4 per bone, mesh.vs with DUAL_QUATERNION. Rigid bones only, scale is dropped
 };
 
 class Model{
 public:
     // Properties
     bool gammaCorrection;
+    bool headless;          // Loaded without GL resources, for CPU only consumers
+    SkinningMode skinningMode = SKINNING_LINEAR;
     
     // Functions
     // -- Constructors and Destructor
-    Model(char *path, bool gamma = false);
+    Model(char *path, bool gamma = false, bool headless = false);
     ~Model();
     
     // -- Getter Functions
-    std::map<std::string, BoneInfo> GetBoneInfoMap(){ return mBoneInfoMap;}
-    int GetBoneCount(){return mBoneCounter;}
+    /* Hierarchy and bone palette layout, shared with every clip bound to this model */
+    const std::shared_ptr<Skeleton>& GetSkeleton() const { return mSkeleton; }
+    int GetBoneCount() const { return mSkeleton->GetBoneCount(); }
+    const std::vector<Mesh>& GetMeshes() const { return meshes; }
+    bool HasMorphTargets() const;
+    /* Sets the weight of the blend shape with that name on every mesh that has it */
+    void SetMorphWeight(const std::string &name, float weight);
+    /* True if some mesh needs the skinning variant for influenceCount, see INFLUENCE_BUCKETS */
+    bool HasInfluenceBucket(int influenceCount) const;
     
     // -- Render Functions
     void draw(Shader &shader);
     
+    /* Draws every instance in a single call per mesh. The per instance data is streamed
+        into a buffer shared by all the meshes of the model */
+    void drawInstanced(Shader &shader, const std::vector<InstanceData> &instances);
+    
+    /* Skinning pre-pass: skins every mesh once with skinning_feedback.vs, whose palette
+        palette slices are uploaded per mesh. Any number of drawSkinned calls can follow this frame */
+    void skin(Shader &feedbackShader, const PaletteSet &palettes);
+    void drawSkinned(Shader &shader);
+    
+    /* Same result as draw with a skinning shader, but the triangles that follow a single
+        bone are drawn by rigidShader (mesh.vs without features) with palette[boneId] folded into
+        the model matrix, skipping the per vertex influence loop */
+    /* influenceCount 0 draws every mesh, otherwise only the meshes of that influence
+        bucket, for the skinning shader variant compiled for it. Each mesh uploads its own
+        slice of the palettes before drawing */
+    void drawDeformable(Shader &skinningShader, const PaletteSet &palettes, int influenceCount = 0);
+    /* Sums each mesh's active blend shapes into its offsets texture, with morph_scatter.vs
+        when there are too many deltas for the CPU. Call once per frame before drawing */
+    void applyMorphTargets(Shader &scatterShader);
+    void drawRigid(Shader &rigidShader, const std::vector<glm::mat4> &palette, const glm::mat4 &model);
+    
 private:
     // Properties
     // -- Model data
     std::vector<Mesh> meshes;
     std::string directory;
     std::vector<Texture> textures_loaded;
+    unsigned int instanceVBO = 0;
     
     // -- Animation data
-    std::map<std::string, BoneInfo> mBoneInfoMap;
-    int mBoneCounter=0;
+    std::shared_ptr<Skeleton> mSkeleton;
     
     // Functions
     
@@ -65,6 +99,13 @@ private:
     // -- Animation functions
     void setVertexBoneDataToDefault(Vertex &vertex);
     void setVertexBoneData(Vertex &vertex, int boneId, float weight);
-    void extractBoneWeightForVertices(std::vector<Vertex> &vertices, aiMesh *mesh, const aiScene *scene);
+    /* Sorts each vertex's influences heaviest first, prunes those below MIN_BONE_WEIGHT
+        and rescales the rest to sum to 1 */
+    void normalizeBoneWeights(std::vector<Vertex> &vertices);
+    /* Vertices get the mesh's palette slots, paletteBones the skeleton bone of each slot */
+    void extractBoneWeightForVertices(std::vector<Vertex> &vertices, std::vector<int> &paletteBones, aiMesh *mesh, const aiScene *scene);
+    void readSkeletonNodes(const aiNode *node, int parent);
+    /* Blend shapes of the mesh as deltas from the base vertices, only those that move */
+    MorphTargets extractMorphTargets(const std::vector<Vertex> &vertices, aiMesh *mesh);
 };
 #endif /* Model_hpp */
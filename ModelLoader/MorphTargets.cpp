@@ -0,0 +1,200 @@
+//
+//  MorphTargets.cpp
+//  ModelLoader
+//
+//  Created by Apple on 19/10/26.
+//
+
+#include "MorphTargets.hpp"
+
+void MorphTargets::AddTarget(const std::string &name, const std::vector<MorphDelta> &deltas){
+    MorphTarget target;
+    target.name = name;
+    target.firstDelta = (unsigned int)mDeltas.size();
+    target.deltaCount = (unsigned int)deltas.size();
+    target.weight = 0.0f;
+    mTargets.push_back(target);
+    mDeltas.insert(mDeltas.end(), deltas.begin(), deltas.end());
+}
+
+void MorphTargets::Upload(unsigned int vertexCount){
+    if(mTargets.empty()){
+        return;
+    }
+    
+    mTextureHeight = (vertexCount * 2 + MORPH_TEXTURE_WIDTH - 1) / MORPH_TEXTURE_WIDTH;
+    mOffsets.assign(mTextureHeight * MORPH_TEXTURE_WIDTH, glm::vec4(0.0f));
+    mTouched.assign(vertexCount, 0);
+    mDirtyRows.assign(mTextureHeight, 0);
+    
+    // -- Offsets texture, also the render target of the GPU scatter
+    glGenTextures(1, &mOffsetsTexture);
+    GLState::BindTexture(GL_TEXTURE_2D, mOffsetsTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, MORPH_TEXTURE_WIDTH, mTextureHeight, 0, GL_RGBA, GL_FLOAT, &mOffsets[0]);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    GLState::BindTexture(GL_TEXTURE_2D, 0);
+    
+    glGenFramebuffers(1, &mFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, mFramebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mOffsetsTexture, 0);
+    if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE){
+        LOGGER("Morph offsets framebuffer incomplete, blend shapes are summed on the CPU only");
+        glDeleteFramebuffers(1, &mFramebuffer);
+        mFramebuffer = 0;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    
+    // -- Deltas, one point each for the scatter
+    glGenVertexArrays(1, &mDeltaVAO);
+    glGenBuffers(1, &mDeltaVBO);
+    GLState::BindVertexArray(mDeltaVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, mDeltaVBO);
+    glBufferData(GL_ARRAY_BUFFER, mDeltas.size() * sizeof(MorphDelta), &mDeltas[0], GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribIPointer(0, 1, GL_UNSIGNED_INT, sizeof(MorphDelta), (void *) offsetof(MorphDelta, vertex));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(MorphDelta), (void *) offsetof(MorphDelta, position));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(MorphDelta), (void *) offsetof(MorphDelta, normal));
+    GLState::BindVertexArray(0);
+    
+    size_t deltaBytes = mDeltas.size() * sizeof(MorphDelta);
+    LOGGER("Morph targets: "+std::to_string(mTargets.size())+" targets, "+std::to_string(mDeltas.size())+" deltas ("
+           +std::to_string(deltaBytes / 1024)+" KB) for "+std::to_string(vertexCount)+" vertices");
+}
+
+int MorphTargets::FindTarget(const std::string &name) const{
+    for(size_t i=0; i<mTargets.size(); i++){
+        if(mTargets[i].name == name){
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+unsigned int MorphTargets::GetActiveDeltaCount() const{
+    unsigned int count = 0;
+    for(size_t i=0; i<mTargets.size(); i++){
+        if(mTargets[i].weight != 0.0f){
+            count += mTargets[i].deltaCount;
+        }
+    }
+    return count;
+}
+
+void MorphTargets::Apply(Shader &scatterShader){
+    if(mOffsetsTexture == 0){
+        return;
+    }
+    
+    if(GetActiveDeltaCount() <= MORPH_CPU_MAX_DELTAS || mFramebuffer == 0){
+        ApplyOnCPU();
+    }else{
+        ApplyOnGPU(scatterShader);
+    }
+}
+
+void MorphTargets::ClearTouched(){
+    for(size_t i=0; i<mTouchedVertices.size(); i++){
+        unsigned int vertex = mTouchedVertices[i];
+        mOffsets[vertex * 2 + 0] = glm::vec4(0.0f);
+        mOffsets[vertex * 2 + 1] = glm::vec4(0.0f);
+        mTouched[vertex] = 0;
+        mDirtyRows[vertex * 2 / MORPH_TEXTURE_WIDTH] = 1;
+    }
+    mTouchedVertices.clear();
+}
+
+void MorphTargets::ClearTexture(){
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    glBindFramebuffer(GL_FRAMEBUFFER, mFramebuffer);
+    glViewport(0, 0, MORPH_TEXTURE_WIDTH, mTextureHeight);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
+
+void MorphTargets::ApplyOnCPU(){
+    // Undo last frame, only where it wrote
+    if(mGpuWritten){
+        ClearTexture();
+        mGpuWritten = false;
+    }
+    ClearTouched();
+    
+    for(size_t t=0; t<mTargets.size(); t++){
+        const MorphTarget &target = mTargets[t];
+        if(target.weight == 0.0f){
+            continue;
+        }
+        for(unsigned int i=target.firstDelta; i<target.firstDelta + target.deltaCount; i++){
+            const MorphDelta &delta = mDeltas[i];
+            mOffsets[delta.vertex * 2 + 0] += glm::vec4(delta.position * target.weight, 0.0f);
+            mOffsets[delta.vertex * 2 + 1] += glm::vec4(delta.normal * target.weight, 0.0f);
+            if(!mTouched[delta.vertex]){
+                mTouched[delta.vertex] = 1;
+                mTouchedVertices.push_back(delta.vertex);
+                mDirtyRows[delta.vertex * 2 / MORPH_TEXTURE_WIDTH] = 1;
+            }
+        }
+    }
+    
+    // Upload the rows that changed
+    GLState::BindTexture(GL_TEXTURE_2D, mOffsetsTexture);
+    for(unsigned int row=0; row<mTextureHeight; row++){
+        if(mDirtyRows[row]){
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, row, MORPH_TEXTURE_WIDTH, 1, GL_RGBA, GL_FLOAT, &mOffsets[row * MORPH_TEXTURE_WIDTH]);
+            mDirtyRows[row] = 0;
+        }
+    }
+    GLState::BindTexture(GL_TEXTURE_2D, 0);
+}
+
+void MorphTargets::ApplyOnGPU(Shader &scatterShader){
+    // The CPU copy no longer matches the texture, the scatter rewrites all of it
+    ClearTouched();
+    std::fill(mDirtyRows.begin(), mDirtyRows.end(), 0);
+    ClearTexture();
+    mGpuWritten = true;
+    
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+    glBindFramebuffer(GL_FRAMEBUFFER, mFramebuffer);
+    glViewport(0, 0, MORPH_TEXTURE_WIDTH, mTextureHeight);
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_ONE, GL_ONE);
+    
+    // Instance 0 writes the position offset texel of each delta, instance 1 the normal one
+    scatterShader.use();
+    scatterShader.setVector2f("morphTextureSize", (float)MORPH_TEXTURE_WIDTH, (float)mTextureHeight);
+    GLState::BindVertexArray(mDeltaVAO);
+    for(size_t t=0; t<mTargets.size(); t++){
+        const MorphTarget &target = mTargets[t];
+        if(target.weight == 0.0f || target.deltaCount == 0){
+            continue;
+        }
+        scatterShader.setFloat("morphWeight", target.weight);
+        glDrawArraysInstanced(GL_POINTS, target.firstDelta, target.deltaCount, 2);
+    }
+    
+    glDisable(GL_BLEND);
+    if(depthTest){
+        glEnable(GL_DEPTH_TEST);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
+
+void MorphTargets::Bind(Shader &shader) const{
+    shader.setInteger("morphEnabled", mOffsetsTexture != 0);
+    if(mOffsetsTexture == 0){
+        return;
+    }
+    GLState::BindTextureUnit(MORPH_TEXTURE_UNIT, GL_TEXTURE_2D, mOffsetsTexture);
+    shader.setInteger("morphOffsets", MORPH_TEXTURE_UNIT);
+}
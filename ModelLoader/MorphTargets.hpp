@@ -0,0 +1,98 @@
+//
+//  MorphTargets.hpp
+//  ModelLoader
+//
+//  Created by Apple on 19/10/26.
+//
+
+#ifndef MorphTargets_hpp
+#define MorphTargets_hpp
+
+#include <stdio.h>
+#include <GL/glew.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstddef>
+#include <glm/glm.hpp>
+
+#include "Shader.hpp"
+
+// Offsets texture row width in texels, 2 texels per vertex
+#define MORPH_TEXTURE_WIDTH 1024
+// Texture unit the offsets are bound to, above the material textures
+#define MORPH_TEXTURE_UNIT 8
+// Up to this many active deltas are summed on the CPU, more are scattered on the GPU
+#define MORPH_CPU_MAX_DELTAS 4096
+// Deltas shorter than this are not stored
+#define MORPH_DELTA_EPSILON 1e-5f
+
+/* Offset of one vertex in one blend shape */
+struct MorphDelta{
+    unsigned int vertex;
+    glm::vec3 position;
+    glm::vec3 normal;
+};
+
+/* A blend shape, its deltas are stored contiguously */
+struct MorphTarget{
+    std::string name;
+    unsigned int firstDelta;
+    unsigned int deltaCount;
+    float weight;
+};
+
+/* Blend shapes of one mesh kept as sparse deltas, only the vertices a shape moves. Each
+    frame the deltas of the targets with a non zero weight are summed into a per vertex
+    offsets texture (position then normal offset, 2 texels per vertex) that the skinning
+    shader adds before skinning. Few active deltas are summed on the CPU and only the
+    texture rows they touch are uploaded, many are scattered on the GPU as points with
+    additive blending (morph_scatter.vs). Either way the cost follows the active deltas */
+class MorphTargets{
+public:
+    // -- Building, done by Model while loading
+    void AddTarget(const std::string &name, const std::vector<MorphDelta> &deltas);
+    /* Creates the offsets texture and the delta buffer, needs a GL context */
+    void Upload(unsigned int vertexCount);
+    
+    // -- Weights
+    int FindTarget(const std::string &name) const;     // -1 if the mesh has no such target
+    void SetWeight(int target, float weight) { mTargets[target].weight = weight; }
+    unsigned int GetActiveDeltaCount() const;
+    
+    /* Sums the active targets into the offsets texture */
+    void Apply(Shader &scatterShader);
+    
+    /* Binds the offsets for the skinning shader's morphOffsets sampler, or turns morphing
+        off when the mesh has no targets */
+    void Bind(Shader &shader) const;
+    
+    // -- Getters
+    bool IsEmpty() const { return mTargets.empty(); }
+    const std::vector<MorphTarget>& GetTargets() const { return mTargets; }
+    const std::vector<MorphDelta>& GetDeltas() const { return mDeltas; }
+    
+private:
+    // Properties
+    std::vector<MorphTarget> mTargets;
+    std::vector<MorphDelta> mDeltas;
+    
+    // -- Render data
+    unsigned int mOffsetsTexture = 0, mFramebuffer = 0;
+    unsigned int mDeltaVAO = 0, mDeltaVBO = 0;
+    unsigned int mTextureHeight = 0;
+    bool mGpuWritten = false;           // The texture holds a GPU scatter the CPU copy doesn't know about
+    
+    // -- CPU path
+    std::vector<glm::vec4> mOffsets;    // CPU copy of the texture
+    std::vector<unsigned int> mTouchedVertices;
+    std::vector<char> mTouched;         // Per vertex, set for the vertices in mTouchedVertices
+    std::vector<char> mDirtyRows;
+    
+    // Functions
+    void ApplyOnCPU();
+    void ApplyOnGPU(Shader &scatterShader);
+    void ClearTouched();
+    void ClearTexture();
+};
+#endif /* MorphTargets_hpp */
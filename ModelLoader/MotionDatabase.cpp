@@ -0,0 +1,350 @@
+//
+//  MotionDatabase.cpp
+//  ModelLoader
+//
+//  Created by Apple on 19/10/26.
+//
+
+#include "MotionDatabase.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MOTION_DATABASE_X86 1
+#include <immintrin.h>
+#endif
+
+MotionDatabase::MotionDatabase(const std::vector<int> &featureGroups)
+        : mFeatureGroups(featureGroups),
+          mFeatureCount((int)featureGroups.size()),
+          mStride(((int)featureGroups.size() + 3) & ~3){
+}
+
+void MotionDatabase::AddFrame(int clip, float time, const float *rawFeatures){
+    mFeatures.insert(mFeatures.end(), rawFeatures, rawFeatures + mFeatureCount);
+    mFeatures.insert(mFeatures.end(), mStride - mFeatureCount, 0.0f);
+    mFrameClips.push_back(clip);
+    mFrameTimes.push_back(time);
+}
+
+void MotionDatabase::Build(){
+    int frameCount = GetFrameCount();
+    if(frameCount == 0){
+        return;
+    }
+    
+    // -- Per feature mean, per group standard deviation
+    mMeans.assign(mFeatureCount, 0.0f);
+    for(int frame=0; frame<frameCount; frame++){
+        for(int i=0; i<mFeatureCount; i++){
+            mMeans[i] += mFeatures[frame * mStride + i];
+        }
+    }
+    for(int i=0; i<mFeatureCount; i++){
+        mMeans[i] /= frameCount;
+    }
+    
+    int groupCount = *std::max_element(mFeatureGroups.begin(), mFeatureGroups.end()) + 1;
+    std::vector<double> groupVariance(groupCount, 0.0);
+    std::vector<int> groupSize(groupCount, 0);
+    for(int i=0; i<mFeatureCount; i++){
+        groupSize[mFeatureGroups[i]]++;
+        for(int frame=0; frame<frameCount; frame++){
+            float deviation = mFeatures[frame * mStride + i] - mMeans[i];
+            groupVariance[mFeatureGroups[i]] += deviation * deviation;
+        }
+    }
+    mScales.assign(mStride, 0.0f);
+    for(int i=0; i<mFeatureCount; i++){
+        int group = mFeatureGroups[i];
+        float deviation = (float)std::sqrt(groupVariance[group] / ((double)groupSize[group] * frameCount));
+        mScales[i] = deviation > 1e-6f ? 1.0f / deviation : 0.0f;
+    }
+    mMeans.resize(mStride, 0.0f);
+    
+    for(int frame=0; frame<frameCount; frame++){
+        float *row = &mFeatures[frame * mStride];
+        NormalizeQuery(row, row);
+    }
+    
+    // -- KD-tree
+    std::vector<int> frames(frameCount);
+    for(int i=0; i<frameCount; i++){
+        frames[i] = i;
+    }
+    mNodes.clear();
+    mTreeFeatures.clear();
+    mTreeFrames.clear();
+    mNodes.reserve(2 * frameCount / MOTION_KD_LEAF_SIZE + 1);
+    mTreeFeatures.reserve(mFeatures.size());
+    mTreeFrames.reserve(frameCount);
+    BuildNode(frames, 0, frameCount);
+    
+    LOGGER("Motion database: "+std::to_string(frameCount)+" frames, "+std::to_string(mFeatureCount)+" features, "
+           +std::to_string(mNodes.size())+" KD-tree nodes");
+}
+
+int MotionDatabase::BuildNode(std::vector<int> &frames, int begin, int end){
+    int index = (int)mNodes.size();
+    mNodes.push_back(KDNode());
+    
+    // Split on the dimension with the widest spread, at its median
+    int axis = -1;
+    float widest = 0.0f;
+    if(end - begin > MOTION_KD_LEAF_SIZE){
+        for(int i=0; i<mFeatureCount; i++){
+            float low = FLT_MAX, high = -FLT_MAX;
+            for(int f=begin; f<end; f++){
+                float value = mFeatures[frames[f] * mStride + i];
+                low = std::min(low, value);
+                high = std::max(high, value);
+            }
+            if(high - low > widest){
+                widest = high - low;
+                axis = i;
+            }
+        }
+    }
+    
+    if(axis < 0){
+        KDNode &leaf = mNodes[index];
+        leaf.axis = -1;
+        leaf.begin = (int)mTreeFrames.size();
+        for(int f=begin; f<end; f++){
+            const float *row = GetFeatures(frames[f]);
+            mTreeFeatures.insert(mTreeFeatures.end(), row, row + mStride);
+            mTreeFrames.push_back(frames[f]);
+        }
+        leaf.end = (int)mTreeFrames.size();
+        return index;
+    }
+    
+    int middle = (begin + end) / 2;
+    std::nth_element(frames.begin() + begin, frames.begin() + middle, frames.begin() + end,
+                     [&](int a, int b){ return mFeatures[a * mStride + axis] < mFeatures[b * mStride + axis]; });
+    float split = mFeatures[frames[middle] * mStride + axis];
+    
+    int left = BuildNode(frames, begin, middle);
+    int right = BuildNode(frames, middle, end);
+    KDNode &node = mNodes[index];
+    node.axis = axis;
+    node.split = split;
+    node.left = left;
+    node.right = right;
+    return index;
+}
+
+void MotionDatabase::NormalizeQuery(const float *rawFeatures, float *query) const{
+    for(int i=0; i<mFeatureCount; i++){
+        query[i] = (rawFeatures[i] - mMeans[i]) * mScales[i];
+    }
+    for(int i=mFeatureCount; i<mStride; i++){
+        query[i] = 0.0f;
+    }
+}
+
+float MotionDatabase::Distance(const float *a, const float *b) const{
+#ifdef MOTION_DATABASE_X86
+    __m128 sum = _mm_setzero_ps();
+    for(int i=0; i<mStride; i+=4){
+        __m128 difference = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+        sum = _mm_add_ps(sum, _mm_mul_ps(difference, difference));
+    }
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum);
+#else
+    float sum = 0.0f;
+    for(int i=0; i<mStride; i++){
+        float difference = a[i] - b[i];
+        sum += difference * difference;
+    }
+    return sum;
+#endif
+}
+
+MotionMatch MotionDatabase::MakeMatch(int frame, float cost) const{
+    MotionMatch match;
+    if(frame >= 0){
+        match.frame = frame;
+        match.clip = mFrameClips[frame];
+        match.time = mFrameTimes[frame];
+        match.cost = cost;
+    }
+    return match;
+}
+
+MotionMatch MotionDatabase::FindNearest(const float *query) const{
+    if(mNodes.empty()){
+        return MotionMatch();
+    }
+    
+    // Depth first, nearer child first, skipping subtrees beyond the best distance so far
+    struct Pending{
+        int node;
+        float planeDistance;    // Squared distance from the query to the subtree's side of the split
+    };
+    Pending stack[64];
+    int stackSize = 0;
+    stack[stackSize++] = { 0, 0.0f };
+    
+    int bestFrame = -1;
+    float bestCost = FLT_MAX;
+    while(stackSize > 0){
+        Pending pending = stack[--stackSize];
+        if(pending.planeDistance >= bestCost){
+            continue;
+        }
+        
+        const KDNode &node = mNodes[pending.node];
+        if(node.axis < 0){
+            for(int row=node.begin; row<node.end; row++){
+                float cost = Distance(query, &mTreeFeatures[row * mStride]);
+                if(cost < bestCost){
+                    bestCost = cost;
+                    bestFrame = mTreeFrames[row];
+                }
+            }
+            continue;
+        }
+        
+        float offset = query[node.axis] - node.split;
+        int nearChild = offset < 0.0f ? node.left : node.right;
+        int farChild = offset < 0.0f ? node.right : node.left;
+        stack[stackSize++] = { farChild, std::max(pending.planeDistance, offset * offset) };
+        stack[stackSize++] = { nearChild, pending.planeDistance };
+    }
+    return MakeMatch(bestFrame, bestCost);
+}
+
+MotionMatch MotionDatabase::FindNearestBruteForce(const float *query) const{
+    int bestFrame = -1;
+    float bestCost = FLT_MAX;
+    int frameCount = GetFrameCount();
+    for(int frame=0; frame<frameCount; frame++){
+        float cost = Distance(query, &mFeatures[frame * mStride]);
+        if(cost < bestCost){
+            bestCost = cost;
+            bestFrame = frame;
+        }
+    }
+    return MakeMatch(bestFrame, bestCost);
+}
+
+// -- MotionFeatureExtractor
+
+MotionFeatureExtractor::MotionFeatureExtractor(const Skeleton *skeleton, const std::string &rootName,
+                                               const std::vector<std::string> &jointNames,
+                                               const std::vector<float> &trajectoryOffsets)
+        : mSkeleton(skeleton),
+          mTrajectoryOffsets(trajectoryOffsets){
+    mRootNode = std::max(0, skeleton->FindNode(rootName.c_str()));
+    for(size_t i=0; i<jointNames.size(); i++){
+        int node = skeleton->FindNode(jointNames[i].c_str());
+        if(node < 0){
+            LOGGER("Motion features: no joint named "+jointNames[i]+", skipped");
+            continue;
+        }
+        mJointNodes.push_back(node);
+    }
+}
+
+int MotionFeatureExtractor::GetFeatureCount() const{
+    return (int)mJointNodes.size() * 6 + (int)mTrajectoryOffsets.size() * 4;
+}
+
+std::vector<int> MotionFeatureExtractor::GetFeatureGroups() const{
+    // Each joint's position and velocity, then all trajectory positions and all directions
+    std::vector<int> groups;
+    int group = 0;
+    for(size_t i=0; i<mJointNodes.size(); i++, group+=2){
+        groups.insert(groups.end(), 3, group);
+        groups.insert(groups.end(), 3, group + 1);
+    }
+    for(size_t i=0; i<mTrajectoryOffsets.size(); i++){
+        groups.insert(groups.end(), 2, group);
+        groups.insert(groups.end(), 2, group + 1);
+    }
+    return groups;
+}
+
+void MotionFeatureExtractor::SolvePose(const Animation *clip, float animationTime){
+    animationTime = std::max(0.0f, std::min(animationTime, clip->GetDuration()));
+    mCursors.resize(clip->GetBones().size());
+    clip->SamplePose(animationTime, mCursors, 0, mPose);
+    
+    const std::vector<SkeletonNode> &nodes = mSkeleton->GetNodes();
+    mGlobalTransforms.resize(nodes.size());
+    for(size_t i=0; i<nodes.size(); i++){
+        glm::mat4 local = mPose.GetMatrix(i);
+        mGlobalTransforms[i] = nodes[i].parent < 0 ? local : mGlobalTransforms[nodes[i].parent] * local;
+    }
+}
+
+void MotionFeatureExtractor::GetCharacterFrame(glm::vec3 &origin, glm::vec3 &forward) const{
+    const glm::mat4 &root = mGlobalTransforms[mRootNode];
+    origin = glm::vec3(root[3].x, 0.0f, root[3].z);
+    forward = glm::vec3(root[2].x, 0.0f, root[2].z);
+    float length = glm::length(forward);
+    forward = length > 1e-6f ? forward * (1.0f / length) : glm::vec3(0.0f, 0.0f, 1.0f);
+}
+
+/* Vector in the character frame given by its forward axis, y stays up */
+static glm::vec3 ToCharacterFrame(const glm::vec3 &vector, const glm::vec3 &forward){
+    glm::vec3 right = glm::vec3(forward.z, 0.0f, -forward.x);
+    return glm::vec3(glm::dot(vector, right), vector.y, glm::dot(vector, forward));
+}
+
+void MotionFeatureExtractor::ExtractFrame(const Animation *clip, float animationTime, float *rawFeatures){
+    float ticksPerSecond = clip->GetTicksPerSecond() > 0 ? clip->GetTicksPerSecond() : 25.0f;
+    float deltaTicks = ticksPerSecond / 60.0f;
+    
+    // Joint positions at animationTime and around it for the velocities
+    std::vector<glm::vec3> before(mJointNodes.size()), after(mJointNodes.size());
+    SolvePose(clip, animationTime - deltaTicks);
+    for(size_t i=0; i<mJointNodes.size(); i++){
+        before[i] = glm::vec3(mGlobalTransforms[mJointNodes[i]][3]);
+    }
+    SolvePose(clip, animationTime + deltaTicks);
+    for(size_t i=0; i<mJointNodes.size(); i++){
+        after[i] = glm::vec3(mGlobalTransforms[mJointNodes[i]][3]);
+    }
+    
+    SolvePose(clip, animationTime);
+    glm::vec3 origin, forward;
+    GetCharacterFrame(origin, forward);
+    
+    float *feature = rawFeatures;
+    for(size_t i=0; i<mJointNodes.size(); i++){
+        glm::vec3 position = ToCharacterFrame(glm::vec3(mGlobalTransforms[mJointNodes[i]][3]) - origin, forward);
+        glm::vec3 velocity = ToCharacterFrame((after[i] - before[i]) * (ticksPerSecond / (2.0f * deltaTicks)), forward);
+        for(int axis=0; axis<3; axis++){
+            *feature++ = position[axis];
+        }
+        for(int axis=0; axis<3; axis++){
+            *feature++ = velocity[axis];
+        }
+    }
+    
+    // Where the root will be and face, clamped at the end of the clip
+    for(size_t i=0; i<mTrajectoryOffsets.size(); i++){
+        SolvePose(clip, animationTime + mTrajectoryOffsets[i] * ticksPerSecond);
+        glm::vec3 futureOrigin, futureForward;
+        GetCharacterFrame(futureOrigin, futureForward);
+        glm::vec3 position = ToCharacterFrame(futureOrigin - origin, forward);
+        glm::vec3 direction = ToCharacterFrame(futureForward, forward);
+        *feature++ = position.x;
+        *feature++ = position.z;
+        *feature++ = direction.x;
+        *feature++ = direction.z;
+    }
+}
+
+void MotionFeatureExtractor::ExtractClip(const Animation *clip, int clipIndex, float sampleRate, MotionDatabase &database){
+    float ticksPerSecond = clip->GetTicksPerSecond() > 0 ? clip->GetTicksPerSecond() : 25.0f;
+    int frameCount = std::max(1, (int)(clip->GetDuration() / ticksPerSecond * sampleRate));
+    std::vector<float> features(GetFeatureCount());
+    for(int frame=0; frame<frameCount; frame++){
+        float animationTime = frame * ticksPerSecond / sampleRate;
+        ExtractFrame(clip, animationTime, &features[0]);
+        database.AddFrame(clipIndex, animationTime, &features[0]);
+    }
+}
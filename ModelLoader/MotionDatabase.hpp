@@ -0,0 +1,125 @@
+//
+//  MotionDatabase.hpp
+//  ModelLoader
+//
+//  Created by Apple on 19/10/26.
+//
+
+#ifndef MotionDatabase_hpp
+#define MotionDatabase_hpp
+
+#include <stdio.h>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+#include <glm/glm.hpp>
+
+#include "Animation.hpp"
+#include "Logger.h"
+
+// Frames per KD-tree leaf, scanned linearly
+#define MOTION_KD_LEAF_SIZE 16
+
+/* Best frame for a query, cost is the squared distance in normalised feature space */
+struct MotionMatch{
+    int frame = -1;
+    int clip = -1;
+    float time = 0.0f;      // Ticks, as Animator::SetAnimationTime takes it
+    float cost = FLT_MAX;
+};
+
+/* Normalised features of every frame of every clip, searched for the frame closest to a
+    query. Each dimension is centred on its mean and divided by the standard deviation of
+    its group (a joint's position, a joint's velocity, ...) so that no group outweighs
+    another because of its units. Rows are padded to a multiple of 4 floats for SIMD */
+class MotionDatabase{
+public:
+    /* featureGroups has one entry per raw feature, features of a group share a scale */
+    explicit MotionDatabase(const std::vector<int> &featureGroups);
+    
+    // -- Building
+    void AddFrame(int clip, float time, const float *rawFeatures);
+    /* Normalises the features and builds the KD-tree, call once every frame is in */
+    void Build();
+    
+    // -- Search
+    /* Normalises raw features the way the database was, query gets GetStride() floats */
+    void NormalizeQuery(const float *rawFeatures, float *query) const;
+    /* Exact nearest frame through the KD-tree */
+    MotionMatch FindNearest(const float *query) const;
+    /* Exact nearest frame scanning every row, 4 dimensions at a time where SSE is available.
+        Faster than the tree when the features don't lie on a low dimensional manifold */
+    MotionMatch FindNearestBruteForce(const float *query) const;
+    
+    // -- Getters
+    int GetFeatureCount() const { return mFeatureCount; }
+    int GetStride() const { return mStride; }
+    int GetFrameCount() const { return (int)mFrameClips.size(); }
+    const float* GetFeatures(int frame) const { return &mFeatures[frame * mStride]; }
+    
+private:
+    struct KDNode{
+        int axis;               // -1 for a leaf
+        float split;
+        int left, right;        // Children, inner nodes only
+        int begin, end;         // Rows of mTreeFeatures, leaves only
+    };
+    
+    // Properties
+    std::vector<int> mFeatureGroups;
+    int mFeatureCount;
+    int mStride;
+    std::vector<float> mFeatures;           // Raw until Build, then normalised
+    std::vector<int> mFrameClips;
+    std::vector<float> mFrameTimes;
+    std::vector<float> mMeans;
+    std::vector<float> mScales;             // 1 / group standard deviation
+    
+    // -- KD-tree, rows reordered so each leaf is contiguous
+    std::vector<KDNode> mNodes;
+    std::vector<float> mTreeFeatures;
+    std::vector<int> mTreeFrames;
+    
+    // Functions
+    int BuildNode(std::vector<int> &frames, int begin, int end);
+    float Distance(const float *a, const float *b) const;
+    MotionMatch MakeMatch(int frame, float cost) const;
+};
+
+/* Extracts motion matching features from the Bone tracks of clips sharing one Skeleton:
+    position and velocity of a few joints and the future trajectory of the root, all in the
+    character's frame (root projected on the ground, facing along its z axis) */
+class MotionFeatureExtractor{
+public:
+    /* trajectoryOffsets in seconds, e.g. 1/3, 2/3 and 1 */
+    MotionFeatureExtractor(const Skeleton *skeleton, const std::string &rootName,
+                           const std::vector<std::string> &jointNames,
+                           const std::vector<float> &trajectoryOffsets);
+    
+    /* Group of each feature, for MotionDatabase */
+    std::vector<int> GetFeatureGroups() const;
+    int GetFeatureCount() const;
+    
+    /* Raw features of clip at animationTime (ticks) */
+    void ExtractFrame(const Animation *clip, float animationTime, float *rawFeatures);
+    /* Adds every frame of clip at sampleRate frames per second */
+    void ExtractClip(const Animation *clip, int clipIndex, float sampleRate, MotionDatabase &database);
+    
+private:
+    // Properties
+    const Skeleton *mSkeleton;
+    int mRootNode;
+    std::vector<int> mJointNodes;
+    std::vector<float> mTrajectoryOffsets;
+    std::vector<BoneCursor> mCursors;
+    LocalPose mPose;
+    std::vector<glm::mat4> mGlobalTransforms;
+    
+    // Functions
+    /* Solves the hierarchy of clip at animationTime, clamped to the clip */
+    void SolvePose(const Animation *clip, float animationTime);
+    void GetCharacterFrame(glm::vec3 &origin, glm::vec3 &forward) const;
+};
+#endif /* MotionDatabase_hpp */
@@ -0,0 +1,84 @@
+//
+//  PoseCache.cpp
+//  ModelLoader
+//
+//  Created by Apple on 19/10/26.
+//
+
+#include "PoseCache.hpp"
+
+PoseCache::PoseCache(float timeQuantum)
+        : mTimeQuantum(timeQuantum), mGeneration(0), mUsedPalettes(0), mFrameHits(0), mFrameMisses(0), mTotalHits(0), mTotalMisses(0){
+    
+}
+
+void PoseCache::BeginFrame(){
+    std::lock_guard<std::mutex> lock(mMutex);
+    mTotalHits += mFrameHits;
+    mTotalMisses += mFrameMisses;
+    mFrameHits = 0;
+    mFrameMisses = 0;
+    
+    // Last frame's palettes are left alone, this frame reuses the ones from the frame before
+    mIndex.clear();
+    mGeneration = 1 - mGeneration;
+    mUsedPalettes = 0;
+}
+
+long long PoseCache::QuantizeTime(float animationTime, float ticksPerSecond, float &sampleTime) const{
+    float quantum = mTimeQuantum * ticksPerSecond;
+    if(quantum <= 0.0f){
+        // Exact sharing, the bit pattern of the time is the key
+        sampleTime = animationTime;
+        long long timeIndex = 0;
+        memcpy(&timeIndex, &animationTime, sizeof(animationTime));
+        return timeIndex;
+    }
+    
+    long long timeIndex = (long long)floor(animationTime / quantum + 0.5f);
+    sampleTime = timeIndex * quantum;
+    return timeIndex;
+}
+
+const std::vector<glm::mat4>* PoseCache::Find(const Animation *clip, long long timeIndex, int skeletonLOD){
+    Key key = { clip, timeIndex, skeletonLOD };
+    
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto entry = mIndex.find(key);
+    if(entry == mIndex.end()){
+        mFrameMisses++;
+        return nullptr;
+    }
+    mFrameHits++;
+    return &mPalettes[mGeneration][entry->second];
+}
+
+const std::vector<glm::mat4>* PoseCache::Insert(const Animation *clip, long long timeIndex, int skeletonLOD, const std::vector<glm::mat4> &palette){
+    Key key = { clip, timeIndex, skeletonLOD };
+    
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto entry = mIndex.find(key);
+    std::deque<std::vector<glm::mat4>> &palettes = mPalettes[mGeneration];
+    if(entry != mIndex.end()){
+        return &palettes[entry->second];
+    }
+    
+    // Reuse a slot from an earlier frame when there is one
+    if(mUsedPalettes == palettes.size()){
+        palettes.push_back(std::vector<glm::mat4>());
+    }
+    size_t slot = mUsedPalettes++;
+    palettes[slot] = palette;
+    mIndex[key] = slot;
+    return &palettes[slot];
+}
+
+float PoseCache::GetFrameHitRate() const{
+    unsigned int lookups = mFrameHits + mFrameMisses;
+    return lookups > 0 ? mFrameHits / (float)lookups : 0.0f;
+}
+
+float PoseCache::GetTotalHitRate() const{
+    unsigned long long lookups = mTotalHits + mTotalMisses;
+    return lookups > 0 ? mTotalHits / (float)lookups : 0.0f;
+}
@@ -0,0 +1,93 @@
+//
+//  PoseCache.hpp
+//  ModelLoader
+//
+//  Created by Apple on 19/10/26.
+//
+
+#ifndef PoseCache_hpp
+#define PoseCache_hpp
+
+#include <stdio.h>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <cstring>
+#include <cmath>
+#include <glm/glm.hpp>
+
+class Animation;
+
+/* Frame local cache of solved palettes keyed by (clip, quantised time, skeleton LOD).
+    Animators playing the same clip at the same quantised time get the same palette and
+    only the first one samples and solves the hierarchy. A palette stays valid and
+    unchanged until the second BeginFrame after it was stored, so an animator that skips
+    a frame can still copy it. Safe to use from Animator::UpdateAnimations' worker threads */
+class PoseCache{
+public:
+    // -- Constructor
+    // timeQuantum is in seconds, 0 only shares exactly equal times
+    PoseCache(float timeQuantum = 1.0f / 60.0f);
+    
+    /* Forgets the previous frame's palettes, keeping their memory for reuse */
+    void BeginFrame();
+    
+    /* Rounds animationTime (in ticks) to the quantum. Returns the quantum index used as
+        key, sampleTime receives the time the shared palette is evaluated at */
+    long long QuantizeTime(float animationTime, float ticksPerSecond, float &sampleTime) const;
+    
+    /* Palette stored for the key, nullptr on a miss */
+    const std::vector<glm::mat4>* Find(const Animation *clip, long long timeIndex, int skeletonLOD);
+    
+    /* Stores a copy of palette for the key. If another thread stored one first that one
+        is kept and returned instead */
+    const std::vector<glm::mat4>* Insert(const Animation *clip, long long timeIndex, int skeletonLOD, const std::vector<glm::mat4> &palette);
+    
+    // -- Settings
+    void SetTimeQuantum(float timeQuantum) { mTimeQuantum = timeQuantum; }
+    float GetTimeQuantum() const { return mTimeQuantum; }
+    
+    // -- Statistics
+    unsigned int GetFrameHits() const { return mFrameHits; }
+    unsigned int GetFrameMisses() const { return mFrameMisses; }
+    float GetFrameHitRate() const;                      // Hits over lookups of the current frame
+    unsigned long long GetTotalHits() const { return mTotalHits; }
+    unsigned long long GetTotalMisses() const { return mTotalMisses; }
+    float GetTotalHitRate() const;                      // Since construction
+    
+private:
+    struct Key{
+        const Animation *clip;
+        long long timeIndex;
+        int skeletonLOD;
+        
+        bool operator==(const Key &other) const{
+            return clip == other.clip && timeIndex == other.timeIndex && skeletonLOD == other.skeletonLOD;
+        }
+    };
+    
+    struct KeyHash{
+        size_t operator()(const Key &key) const{
+            size_t hash = std::hash<const void*>()(key.clip);
+            hash ^= std::hash<long long>()(key.timeIndex) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+            hash ^= std::hash<int>()(key.skeletonLOD) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+            return hash;
+        }
+    };
+    
+    // Properties
+    float mTimeQuantum;
+    std::mutex mMutex;
+    std::unordered_map<Key, size_t, KeyHash> mIndex;    // Key to slot in the current generation
+    std::deque<std::vector<glm::mat4>> mPalettes[2];    // This frame's and last frame's, deques so palettes never move
+    int mGeneration;
+    size_t mUsedPalettes;
+    
+    std::atomic<unsigned int> mFrameHits;
+    std::atomic<unsigned int> mFrameMisses;
+    unsigned long long mTotalHits;
+    unsigned long long mTotalMisses;
+};
+#endif /* PoseCache_hpp */
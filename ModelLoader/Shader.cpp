@@ -19,60 +19,272 @@ Shader::Shader(const char* vertexLocation, const char* fragmentLocation, const c
     //compileShader(vertexCode, fragmentCode);
     compile(vertexCode, fragmentCode);
 }
+Shader::Shader(const char* vertexLocation, const char* fragmentLocation, const std::vector<std::string> &defines){
+    std::string defineList;
+    for(size_t i=0; i<defines.size(); i++){
+        defineList += " " + defines[i];
+    }
+    LOGGER("Creating shaders from "+std::string(vertexLocation)+", "+std::string(fragmentLocation)+" with"+defineList);
+    std::string vertexString = injectDefines(readFile(vertexLocation), defines);
+    std::string fragmentString = injectDefines(readFile(fragmentLocation), defines);
+    compile(vertexString.c_str(), fragmentString.c_str());
+}
+Shader::Shader(const char* computeLocation){
+    LOGGER("Creating compute shader from "+std::string(computeLocation));
+    std::string computeString = readFile(computeLocation);
+    compileCompute(computeString.c_str());
+}
+Shader::Shader(const char* vertexLocation, const std::vector<const char*> &feedbackVaryings){
+    LOGGER("Creating transform feedback shader from "+std::string(vertexLocation));
+    std::string vertexString = readFile(vertexLocation);
+    compileFeedback(vertexString.c_str(), feedbackVaryings);
+}
 Shader::~Shader(){
     
 }
 
 // -- Others
 Shader& Shader::use(){
-    glUseProgram(this->ID);
+    if(pending){
+        finishProgram(this->ID);
+        pending = false;
+    }
+    GLState::UseProgram(this->ID);
     return *this;
 }
 
 void Shader::compile(const char* vertexSource, const char* fragmentSource, const char* geometrySource){
-    unsigned int sVertex, sFragment, sGeometry;
-    
-    // SHADER CREATION
-    // --VERTEX SHADER
-    sVertex = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(sVertex, 1, &vertexSource, NULL);
-    glCompileShader(sVertex);
-    this->checkCompileErrors(sVertex, "VERTEX");
-    
-    // --FRAGMENT SHADER
-    sFragment = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(sFragment, 1, &fragmentSource, NULL);
-    glCompileShader(sFragment);
-    this->checkCompileErrors(sFragment, "FRAGMENT");
-    
-    // --GEOMETRY SHADER
+    std::vector<GLenum> stages = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+    std::vector<const char*> sources = { vertexSource, fragmentSource };
     // Check if Geometry Shader source code is given
     if(geometrySource != nullptr){
-        sGeometry = glCreateShader(GL_GEOMETRY_SHADER);
-        glShaderSource(sGeometry, 1, &geometrySource, NULL);
-        glCompileShader(sGeometry);
-        this->checkCompileErrors(sGeometry, "GEOMETRY");
+        stages.push_back(GL_GEOMETRY_SHADER);
+        sources.push_back(geometrySource);
     }
-    
+    linkProgram(stages, sources, std::vector<const char*>());
+}
+
+void Shader::compileCompute(const char* computeSource){
+    linkProgram({ GL_COMPUTE_SHADER }, { computeSource }, std::vector<const char*>());
+}
+
+void Shader::compileFeedback(const char* vertexSource, const std::vector<const char*> &feedbackVaryings){
+    linkProgram({ GL_VERTEX_SHADER }, { vertexSource }, feedbackVaryings);
+}
+
+void Shader::linkProgram(const std::vector<GLenum> &stages, const std::vector<const char*> &sources, const std::vector<const char*> &feedbackVaryings){
     // SHADER PROGRAM CREATION
     this->ID = glCreateProgram();
+    uint64_t cacheKey = hashSources(sources, feedbackVaryings);
+    if(loadBinary(this->ID, cacheKey)){
+        return;
+    }
     
-    // attach the shaders, sequence doesn't matter while attaching
-    glAttachShader(this->ID, sVertex);
-    glAttachShader(this->ID, sFragment);
-    if(geometrySource != nullptr){
-        glAttachShader(this->ID, sGeometry);
+    PendingProgram program;
+    program.cacheKey = cacheKey;
+    for(size_t i=0; i<stages.size(); i++){
+        unsigned int shader = glCreateShader(stages[i]);
+        glShaderSource(shader, 1, &sources[i], NULL);
+        glCompileShader(shader);
+        glAttachShader(this->ID, shader);
+        program.shaders.push_back(shader);
+        program.stageNames.push_back(stages[i] == GL_VERTEX_SHADER ? "VERTEX" :
+                                     stages[i] == GL_FRAGMENT_SHADER ? "FRAGMENT" :
+                                     stages[i] == GL_GEOMETRY_SHADER ? "GEOMETRY" : "COMPUTE");
     }
     
-    // link the shaders now, this will link the above attached shaders as per the OpenGL Pipeline
+    // Captured outputs must be declared before linking
+    if(!feedbackVaryings.empty()){
+        glTransformFeedbackVaryings(this->ID, (GLsizei)feedbackVaryings.size(), &feedbackVaryings[0], GL_INTERLEAVED_ATTRIBS);
+    }
+    if(binaryCacheSupported()){
+        glProgramParameteri(this->ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+    
+    // Not checked here, querying the status would wait for the driver
     glLinkProgram(this->ID);
-    this->checkCompileErrors(this->ID, "PROGRAM");
+    pendingPrograms[this->ID] = program;
+    pending = true;
+}
+
+// -- Pending programs
+std::map<unsigned int, Shader::PendingProgram> Shader::pendingPrograms;
+
+bool Shader::parallelCompileSupported(){
+    static int supported = -1;
+    if(supported < 0){
+        supported = glewIsSupported("GL_KHR_parallel_shader_compile") ? 1 : 0;
+#ifdef GL_KHR_parallel_shader_compile
+        if(supported){
+            glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);     // As many as the driver wants
+        }
+#endif
+    }
+    return supported == 1;
+}
+
+bool Shader::isProgramReady(unsigned int program){
+    // Without the extension there is no way to ask, finishing it may block
+    if(!parallelCompileSupported()){
+        return true;
+    }
+    int completed = GL_FALSE;
+    glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &completed);
+    return completed == GL_TRUE;
+}
+
+void Shader::finishProgram(unsigned int program){
+    auto iter = pendingPrograms.find(program);
+    if(iter == pendingPrograms.end()){
+        return;
+    }
+    
+    const PendingProgram &pendingProgram = iter->second;
+    for(size_t i=0; i<pendingProgram.shaders.size(); i++){
+        checkCompileErrors(pendingProgram.shaders[i], pendingProgram.stageNames[i]);
+    }
+    checkCompileErrors(program, "PROGRAM");
+    
+    int success;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if(success){
+        saveBinary(program, pendingProgram.cacheKey);
+    }
     
     // delete the shader now as those are linked to our program object and no longer required
-    glDeleteShader(sFragment);
-    glDeleteShader(sVertex);
-    if(geometrySource != nullptr){
-        glDeleteShader(sGeometry);
+    for(unsigned int shader : pendingProgram.shaders){
+        glDetachShader(program, shader);
+        glDeleteShader(shader);
+    }
+    pendingPrograms.erase(iter);
+}
+
+bool Shader::PollPendingPrograms(){
+    for(auto iter = pendingPrograms.begin(); iter != pendingPrograms.end(); ){
+        unsigned int program = (iter++)->first;
+        if(isProgramReady(program)){
+            finishProgram(program);
+        }
+    }
+    return pendingPrograms.empty();
+}
+
+void Shader::FinishPendingPrograms(){
+    size_t programCount = pendingPrograms.size();
+    auto start = std::chrono::high_resolution_clock::now();
+    while(!PollPendingPrograms()){
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+    LOGGER("Waited "+std::to_string(elapsed.count())+" ms for "+std::to_string(programCount)+" programs to compile");
+}
+
+// -- Binary cache
+bool Shader::binaryCacheSupported(){
+    static int supported = -1;
+    if(supported < 0){
+        int formatCount = 0;
+        if(GLEW_ARB_get_program_binary){
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+        }
+        supported = formatCount > 0 ? 1 : 0;
+        if(supported){
+            mkdir(SHADER_CACHE_DIRECTORY, 0755);
+        }
+    }
+    return supported == 1;
+}
+
+/* FNV-1a over the driver strings, sources and captured varyings. A driver update
+    changes the key, so stale binaries are never even looked up. Programs built from
+    embedded files use the hashes embed_shaders.py computed instead of their text */
+uint64_t Shader::hashSources(const std::vector<const char*> &sources, const std::vector<const char*> &feedbackVaryings){
+    uint64_t hash = 14695981039346656037ull;
+    auto hashString = [&hash](const char *text){
+        hash = hashBytes(hash, text ? text : "", text ? strlen(text) + 1 : 1);
+    };
+    hashString((const char*)glGetString(GL_RENDERER));
+    hashString((const char*)glGetString(GL_VERSION));
+    
+    bool precomputed = !sourceHashes.empty() && std::find(sourceHashes.begin(), sourceHashes.end(), 0) == sourceHashes.end();
+    if(precomputed){
+        hash = hashBytes(hash, sourceHashes.data(), sourceHashes.size() * sizeof(uint64_t));
+    }else{
+        for(const char *source : sources){
+            hashString(source);
+        }
+    }
+    sourceHashes.clear();
+    
+    for(const char *varying : feedbackVaryings){
+        hashString(varying);
+    }
+    return hash;
+}
+
+uint64_t Shader::hashBytes(uint64_t hash, const void *data, size_t length){
+    const unsigned char *bytes = (const unsigned char*)data;
+    for(size_t i=0; i<length; i++){
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+std::string Shader::cachePath(uint64_t cacheKey){
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long)cacheKey);
+    return std::string(SHADER_CACHE_DIRECTORY) + name;
+}
+
+bool Shader::loadBinary(unsigned int program, uint64_t cacheKey){
+    if(!binaryCacheSupported()){
+        return false;
+    }
+    std::ifstream file(cachePath(cacheKey), std::ios::in | std::ios::binary);
+    if(!file.is_open()){
+        return false;
+    }
+    
+    uint32_t header[2];     // Magic, binary format
+    std::vector<char> binary;
+    if(file.read((char*)header, sizeof(header)) && header[0] == SHADER_CACHE_MAGIC){
+        binary.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+    if(binary.empty()){
+        return false;
+    }
+    
+    // Drivers may still refuse a binary they wrote, the program is then compiled again
+    glProgramBinary(program, (GLenum)header[1], binary.data(), (GLsizei)binary.size());
+    int success;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if(!success){
+        LOGGER("Program binary "+cachePath(cacheKey)+" was rejected, compiling from source");
+    }
+    return success != 0;
+}
+
+void Shader::saveBinary(unsigned int program, uint64_t cacheKey){
+    if(!binaryCacheSupported()){
+        return;
+    }
+    int length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if(length <= 0){
+        return;
+    }
+    
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    glGetProgramBinary(program, length, &length, &format, binary.data());
+    
+    std::ofstream file(cachePath(cacheKey), std::ios::out | std::ios::binary | std::ios::trunc);
+    uint32_t header[2] = { SHADER_CACHE_MAGIC, (uint32_t)format };
+    file.write((const char*)header, sizeof(header));
+    file.write(binary.data(), length);
+    if(!file){
+        LOGGER("Unable to write program binary "+cachePath(cacheKey));
     }
 }
 
@@ -145,6 +357,32 @@ void Shader::setMatrix4(const char* name, const glm::mat4 &matrix, bool useShade
                        );
 }
 
+void Shader::setIntegerArray(const char* name, const int *values, int count, bool useShader){
+    if(useShader){
+        this->use();
+    }
+    GLuint uniformLocation = glGetUniformLocation(this->ID, name);
+    glUniform1iv(uniformLocation, count, values);
+}
+void Shader::setVector4fArray(const char* name, const glm::vec4 *values, int count, bool useShader){
+    if(useShader){
+        this->use();
+    }
+    GLuint uniformLocation = glGetUniformLocation(this->ID, name);
+    glUniform4fv(uniformLocation, count, glm::value_ptr(values[0]));
+}
+void Shader::setMatrix4Array(const char* name, const glm::mat4 *matrices, int count, bool useShader){
+    if(useShader){
+        this->use();
+    }
+    GLuint uniformLocation = glGetUniformLocation(this->ID, name);
+    glUniformMatrix4fv(uniformLocation,
+                       count,                       // Count
+                       false,                       // Transpose
+                       glm::value_ptr(matrices[0])  // Array elements are contiguous in memory
+                       );
+}
+
 void Shader::checkCompileErrors(unsigned int object, std::string type){
     int success;
     char infoLog[1024];
@@ -172,22 +410,98 @@ void Shader::checkCompileErrors(unsigned int object, std::string type){
     }
 }
 
-std::string Shader::readFile(const char *fileLocation){
-    std::string content;
-    std::ifstream fileStream(fileLocation, std::ios::in);
+std::vector<std::string> Shader::FeatureDefines(unsigned int features){
+    std::vector<std::string> defines;
+    if(features & SHADER_FEATURE_SKINNED)           defines.push_back("SKINNED");
+    if(features & SHADER_FEATURE_DUAL_QUATERNION)   defines.push_back("DUAL_QUATERNION");
+    if(features & SHADER_FEATURE_PALETTE_BLEND)     defines.push_back("PALETTE_BLEND");
+    if(features & SHADER_FEATURE_MORPH_TARGETS)     defines.push_back("MORPH_TARGETS");
+    if(features & SHADER_FEATURE_INSTANCED)         defines.push_back("INSTANCED");
     
-    if(!fileStream.is_open()){
-        LOGGER("Failed to read file "+std::string(fileLocation)+"! File doesn't exists.");
-        return "";
+    int influenceCount = (features & SHADER_FEATURE_INFLUENCES_8) ? 8 :
+                         (features & SHADER_FEATURE_INFLUENCES_4) ? 4 :
+                         (features & SHADER_FEATURE_INFLUENCES_2) ? 2 : 1;
+    if(features & (SHADER_FEATURE_SKINNED | SHADER_FEATURE_DUAL_QUATERNION)){
+        defines.push_back("BONE_INFLUENCES "+std::to_string(influenceCount));
     }
-    
-    std::string line = "";
-    while(!fileStream.eof()){
-        std::getline(fileStream, line);
-        content.append(line+"\n");
+    return defines;
+}
+
+unsigned int Shader::InfluenceFeature(int influenceCount){
+    return influenceCount > 4 ? SHADER_FEATURE_INFLUENCES_8 :
+           influenceCount > 2 ? SHADER_FEATURE_INFLUENCES_4 :
+           influenceCount > 1 ? SHADER_FEATURE_INFLUENCES_2 : 0;
+}
+
+std::string Shader::injectDefines(const std::string &source, const std::vector<std::string> &defines){
+    // #version has to stay the first statement
+    size_t versionEnd = source.find('\n', source.find("#version"));
+    if(source.find("#version") == std::string::npos || versionEnd == std::string::npos){
+        versionEnd = 0;
+    }else{
+        versionEnd++;
     }
     
-    fileStream.close();
+    std::string defineLines;
+    for(size_t i=0; i<defines.size(); i++){
+        defineLines += "#define " + defines[i] + "\n";
+    }
+    sourceHashes.push_back(hashBytes(14695981039346656037ull, defineLines.data(), defineLines.size()));
+    return source.substr(0, versionEnd) + defineLines + source.substr(versionEnd);
+}
+
+std::string Shader::readFile(const char *fileLocation){
+    std::set<std::string> included;
+    const EmbeddedShader *embedded = EmbeddedShaders::Find(fileLocation);
+    sourceHashes.push_back(embedded ? embedded->hash : 0);
+    return readSource(fileLocation, included);
+}
+
+std::string Shader::readSource(const std::string &fileLocation, std::set<std::string> &included){
+    std::string text;
+    const EmbeddedShader *embedded = EmbeddedShaders::Find(fileLocation);
+    if(embedded){
+        text.assign(embedded->source, embedded->length);
+    }else{
+        std::string diskLocation = EmbeddedShaders::GetDiskLocation(fileLocation);
+        std::ifstream fileStream(diskLocation, std::ios::in | std::ios::binary);
+        if(!fileStream.is_open()){
+            LOGGER("Failed to read file "+diskLocation+"! File doesn't exists.");
+            return "";
+        }
+        text.assign(std::istreambuf_iterator<char>(fileStream), std::istreambuf_iterator<char>());
+    }
+    included.insert(fileLocation);
+    std::string directory = fileLocation.substr(0, fileLocation.find_last_of('/') + 1);
     
+    // Copied through in runs between #include lines
+    std::string content;
+    content.reserve(text.size());
+    size_t lineStart = 0;
+    while(lineStart < text.size()){
+        size_t lineEnd = text.find('\n', lineStart);
+        lineEnd = lineEnd == std::string::npos ? text.size() : lineEnd + 1;
+        
+        size_t directive = text.find_first_not_of(" \t", lineStart);
+        if(directive < lineEnd && text.compare(directive, 8, "#include") == 0){
+            std::string line = text.substr(lineStart, lineEnd - lineStart);
+            size_t nameStart = line.find('"');
+            size_t nameEnd = nameStart == std::string::npos ? nameStart : line.find('"', nameStart + 1);
+            if(nameEnd == std::string::npos){
+                LOGGER("Malformed include in "+fileLocation+": "+line);
+            }else{
+                std::string includeLocation = directory + line.substr(nameStart + 1, nameEnd - nameStart - 1);
+                if(!included.count(includeLocation)){
+                    content.append(readSource(includeLocation, included));
+                }
+            }
+        }else{
+            content.append(text, lineStart, lineEnd - lineStart);
+        }
+        lineStart = lineEnd;
+    }
+    if(!content.empty() && content.back() != '\n'){
+        content += '\n';
+    }
     return content;
 }
@@ -13,9 +13,45 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <stdint.h>
+#include <sys/stat.h>
 
 #include "Logger.h"
+#include "EmbeddedShaders.hpp"
+#include "GLState.hpp"
 
+// Linked programs are saved here, named after the hash of their sources and the driver
+#define SHADER_CACHE_DIRECTORY "shader_cache/"
+#define SHADER_CACHE_MAGIC 0x52444853u      // "SHDR"
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+/* Specialisations of mesh.vs, each bit adds a #define. Combined in a bitmask to key the
+    variants of a ShaderVariants */
+enum ShaderFeature{
+    SHADER_FEATURE_SKINNED          = 1 << 0,   // SKINNED, linear blend skinning
+    SHADER_FEATURE_DUAL_QUATERNION  = 1 << 1,   // DUAL_QUATERNION, dual quaternion skinning instead
+    SHADER_FEATURE_PALETTE_BLEND    = 1 << 2,   // PALETTE_BLEND, blends with the previous palette
+    SHADER_FEATURE_MORPH_TARGETS    = 1 << 3,   // MORPH_TARGETS
+    SHADER_FEATURE_INSTANCED        = 1 << 4,   // INSTANCED, model matrix per instance
+    SHADER_FEATURE_INFLUENCES_2     = 1 << 5,   // BONE_INFLUENCES 2, skinned variants without an
+    SHADER_FEATURE_INFLUENCES_4     = 1 << 6,   // influence bit read a single influence
+    SHADER_FEATURE_INFLUENCES_8     = 1 << 7
+};
+
+/* Binary cache and non blocking compilation. A program is first looked up in the cache
+    by hash, a miss issues the compile and link without waiting on the driver. Errors are
+    checked and the binary saved when the program is finished: on its first use(), or
+    earlier through PollPendingPrograms or FinishPendingPrograms. With
+    GL_KHR_parallel_shader_compile the driver compiles them all on its own threads */
 class Shader{
 public:
     // States
@@ -24,11 +60,34 @@ public:
     // Functions
     // -- Constructor and Destructor
     Shader(const char* vertexSource, const char* fragmentSource, const char* geometrySource = nullptr);
+    /* Same program with each entry of defines ("NAME VALUE") added as a #define right after
+        the #version line, to compile specialised variants of one source */
+    Shader(const char* vertexSource, const char* fragmentSource, const std::vector<std::string> &defines);
+    /* Compute program, needs a GL 4.3 context */
+    explicit Shader(const char* computeSource);
+    /* Vertex only program whose outputs named in feedbackVaryings are captured,
+        interleaved, by transform feedback */
+    Shader(const char* vertexSource, const std::vector<const char*> &feedbackVaryings);
     ~Shader();
     
     // -- Others
     Shader &use();
     void compile(const char* vertexSource, const char* fragmentSource, const char* geometrySource = nullptr);
+    void compileCompute(const char* computeSource);
+    void compileFeedback(const char* vertexSource, const std::vector<const char*> &feedbackVaryings);
+    
+    // -- Features
+    /* #define of each ShaderFeature bit set in features */
+    static std::vector<std::string> FeatureDefines(unsigned int features);
+    /* Influence bit of an INFLUENCE_BUCKETS entry */
+    static unsigned int InfluenceFeature(int influenceCount);
+    
+    // -- Pending programs
+    /* Finishes the programs the driver is done with, without blocking. Returns true once
+        none is left, for loading screens that keep drawing meanwhile */
+    static bool PollPendingPrograms();
+    /* Blocks until every program is finished, call after creating them all */
+    static void FinishPendingPrograms();
     
     // -- Utilities
     void setFloat(const char* name, float value, bool useShader = false);
@@ -41,8 +100,47 @@ public:
     void setVector4f(const char* name, const glm::vec4 &value, bool useShader = false);
     void setMatrix4(const char* name, const glm::mat4 &matrix, bool useShader = false);
     
+    // -- Array Utilities, upload count elements starting at name[0] in a single call
+    void setIntegerArray(const char* name, const int *values, int count, bool useShader = false);
+    void setVector4fArray(const char* name, const glm::vec4 *values, int count, bool useShader = false);
+    void setMatrix4Array(const char* name, const glm::mat4 *matrices, int count, bool useShader = false);
+    
 private:
+    /* Program whose link was issued but not checked yet. Keyed by program ID in
+        pendingPrograms, so copies of the Shader share it */
+    struct PendingProgram{
+        std::vector<unsigned int> shaders;
+        std::vector<std::string> stageNames;
+        uint64_t cacheKey;
+    };
+    static std::map<unsigned int, PendingProgram> pendingPrograms;
+    bool pending = false;
+    /* Precomputed hash of each file read for the program being built, 0 for a file that
+        wasn't embedded, then the hash of the injected defines. Consumed by hashSources */
+    std::vector<uint64_t> sourceHashes;
+    
+    void linkProgram(const std::vector<GLenum> &stages, const std::vector<const char*> &sources, const std::vector<const char*> &feedbackVaryings);
+    
+    // -- Pending programs
+    static bool parallelCompileSupported();
+    static bool isProgramReady(unsigned int program);
+    static void finishProgram(unsigned int program);
+    
+    // -- Binary cache
+    static bool binaryCacheSupported();
+    uint64_t hashSources(const std::vector<const char*> &sources, const std::vector<const char*> &feedbackVaryings);
+    static uint64_t hashBytes(uint64_t hash, const void *data, size_t length);
+    static std::string cachePath(uint64_t cacheKey);
+    static bool loadBinary(unsigned int program, uint64_t cacheKey);
+    static void saveBinary(unsigned int program, uint64_t cacheKey);
+    
+    /* Reads the file, from the embedded shaders when it is one, and pastes each
+        #include "file" line's file in place, resolved from the including file's
+        directory. A file is pasted once per program, and whatever #if surrounds the
+        #include: included files guard themselves */
     std::string readFile(const char *fileLocation);
-    void checkCompileErrors(unsigned int object, std::string type);
+    std::string readSource(const std::string &fileLocation, std::set<std::string> &included);
+    std::string injectDefines(const std::string &source, const std::vector<std::string> &defines);
+    static void checkCompileErrors(unsigned int object, std::string type);
 };
 #endif /* Shader_hpp */
@@ -0,0 +1,27 @@
+//
+//  ShaderVariants.cpp
+//  ModelLoader
+//
+//  Created by Apple on 19/10/26.
+//
+
+#include "ShaderVariants.hpp"
+
+ShaderVariants::ShaderVariants(const std::string &vertexLocation, const std::string &fragmentLocation)
+        : mVertexLocation(vertexLocation), mFragmentLocation(fragmentLocation){
+}
+
+Shader& ShaderVariants::Get(unsigned int features){
+    auto iter = mVariants.find(features);
+    if(iter != mVariants.end()){
+        return *iter->second;
+    }
+    
+    Shader *variant = new Shader(mVertexLocation.c_str(), mFragmentLocation.c_str(), Shader::FeatureDefines(features));
+    mVariants[features].reset(variant);
+    return *variant;
+}
+
+void ShaderVariants::Prepare(unsigned int features){
+    Get(features);
+}
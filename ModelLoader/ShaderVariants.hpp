@@ -0,0 +1,39 @@
+//
+//  ShaderVariants.hpp
+//  ModelLoader
+//
+//  Created by Apple on 19/10/26.
+//
+
+#ifndef ShaderVariants_hpp
+#define ShaderVariants_hpp
+
+#include <stdio.h>
+#include <string>
+#include <map>
+#include <memory>
+
+#include "Shader.hpp"
+
+/* Programs built from one vertex and fragment source pair, one per ShaderFeature bitmask.
+    A variant is compiled the first time it is asked for and kept, so the renderer can ask
+    for the cheapest variant of every draw without a file per combination */
+class ShaderVariants{
+public:
+    ShaderVariants(const std::string &vertexLocation, const std::string &fragmentLocation);
+    
+    /* The variant for features, compiling it on the first request */
+    Shader& Get(unsigned int features);
+    /* Issues the compile of a variant known to be needed soon without waiting for it, see
+        Shader::FinishPendingPrograms */
+    void Prepare(unsigned int features);
+    
+    size_t GetVariantCount() const { return mVariants.size(); }
+    
+private:
+    // Properties
+    std::string mVertexLocation;
+    std::string mFragmentLocation;
+    std::map<unsigned int, std::unique_ptr<Shader>> mVariants;
+};
+#endif /* ShaderVariants_hpp */
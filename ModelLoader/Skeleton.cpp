@@ -0,0 +1,298 @@
+//
+//  Skeleton.cpp
+//  ModelLoader
+//
+//  Created by Apple on 19/10/26.
+//
+
+#include "Skeleton.hpp"
+
+Skeleton::Skeleton()
+        : mTotalSkinWeight(0.0f){
+    mHashSlots.assign(64, -1);
+    mLODs.assign(MAX_SKELETON_LOD + 1, SkeletonLOD());
+}
+
+/* FNV-1a */
+uint32_t Skeleton::HashName(const char *name){
+    uint32_t hash = 2166136261u;
+    for(const char *c = name; *c; c++){
+        hash ^= (unsigned char)*c;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+uint32_t Skeleton::GetLayoutHash() const{
+    uint32_t hash = 2166136261u;
+    for(const SkeletonNode &node : mNodes){
+        int fields[3] = { (int)HashName(mNames[node.nameId].c_str()), node.parent, node.boneId };
+        const unsigned char *bytes = (const unsigned char*)fields;
+        for(size_t i=0; i<sizeof(fields); i++){
+            hash ^= bytes[i];
+            hash *= 16777619u;
+        }
+    }
+    return hash;
+}
+
+int Skeleton::FindName(const char *name) const{
+    uint32_t hash = HashName(name);
+    size_t mask = mHashSlots.size() - 1;
+    
+    // Linear probing until the name or an empty slot turns up
+    for(size_t slot = hash & mask; ; slot = (slot + 1) & mask){
+        int nameId = mHashSlots[slot];
+        if(nameId < 0){
+            return -1;
+        }
+        if(mNameHashes[nameId] == hash && mNames[nameId] == name){
+            return nameId;
+        }
+    }
+}
+
+int Skeleton::FindNode(const char *name) const{
+    int nameId = FindName(name);
+    return nameId < 0 ? -1 : mNodeOfName[nameId];
+}
+
+int Skeleton::FindBone(const char *name) const{
+    int nameId = FindName(name);
+    return nameId < 0 ? -1 : mBoneOfName[nameId];
+}
+
+int Skeleton::InternName(const std::string &name){
+    int nameId = FindName(name.c_str());
+    if(nameId >= 0){
+        return nameId;
+    }
+    
+    nameId = (int)mNames.size();
+    mNames.push_back(name);
+    mNameHashes.push_back(HashName(name.c_str()));
+    mNodeOfName.push_back(-1);
+    mBoneOfName.push_back(-1);
+    
+    // Keep the table at most half full so probe chains stay short
+    if(mNames.size() * 2 > mHashSlots.size()){
+        mHashSlots.assign(mHashSlots.size() * 2, -1);
+        for(int i=0; i<(int)mNames.size(); i++){
+            InsertHashSlot(i);
+        }
+    }else{
+        InsertHashSlot(nameId);
+    }
+    return nameId;
+}
+
+void Skeleton::InsertHashSlot(int nameId){
+    size_t mask = mHashSlots.size() - 1;
+    size_t slot = mNameHashes[nameId] & mask;
+    while(mHashSlots[slot] >= 0){
+        slot = (slot + 1) & mask;
+    }
+    mHashSlots[slot] = nameId;
+}
+
+int Skeleton::AddBone(const std::string &name, const glm::mat4 &offset){
+    int nameId = InternName(name);
+    if(mBoneOfName[nameId] >= 0){
+        return mBoneOfName[nameId];
+    }
+    
+    int boneId = (int)mBoneOffsets.size();
+    mBoneOffsets.push_back(offset);
+    mBoneSkinWeights.push_back(0.0f);
+    mBoneBounds.push_back(AABB());
+    mBoneOfName[nameId] = boneId;
+    return boneId;
+}
+
+void Skeleton::AddSkinWeight(int boneId, float weight, const glm::vec3 &position){
+    mBoneSkinWeights[boneId] += weight;
+    mTotalSkinWeight += weight;
+    if(weight > 0.0f){
+        mBoneBounds[boneId].Expand(position);
+    }
+}
+
+int Skeleton::AddNode(const std::string &name, int parent, const glm::mat4 &transformation){
+    assert(parent < (int)mNodes.size());
+    
+    SkeletonNode node;
+    node.nameId = InternName(name);
+    node.parent = parent;
+    node.transformation = transformation;
+    node.boneId = -1;
+    
+    int index = (int)mNodes.size();
+    mNodes.push_back(node);
+    mNodeOfName[node.nameId] = index;
+    return index;
+}
+
+void Skeleton::Finalize(){
+    for(size_t i=0; i<mNodes.size(); i++){
+        mNodes[i].boneId = mBoneOfName[mNodes[i].nameId];
+    }
+    BuildBindPose();
+    BuildLODs();
+}
+
+std::vector<float> Skeleton::MakeSubtreeMask(const char *nodeName, float weight) const{
+    std::vector<float> mask(mBindPose.GetPaddedSize(), 0.0f);
+    int root = FindNode(nodeName);
+    if(root < 0){
+        LOGGER("No node named "+std::string(nodeName)+" to build a mask from");
+        return mask;
+    }
+    
+    // Descendants follow their ancestor in depth-first order, the subtree ends at the
+    // first node that isn't one
+    std::vector<bool> inSubtree(mNodes.size(), false);
+    inSubtree[root] = true;
+    mask[root] = weight;
+    for(size_t i=root + 1; i<mNodes.size() && inSubtree[mNodes[i].parent]; i++){
+        inSubtree[i] = true;
+        mask[i] = weight;
+    }
+    return mask;
+}
+
+void Skeleton::BuildBindPose(){
+    mBindPose.Resize(mNodes.size());
+    for(size_t i=0; i<mNodes.size(); i++){
+        const glm::mat4 &matrix = mNodes[i].transformation;
+        glm::vec3 scale(glm::length(glm::vec3(matrix[0])), glm::length(glm::vec3(matrix[1])), glm::length(glm::vec3(matrix[2])));
+        glm::mat3 rotationMatrix(glm::vec3(matrix[0]) / scale.x, glm::vec3(matrix[1]) / scale.y, glm::vec3(matrix[2]) / scale.z);
+        mBindPose.Set(i, glm::vec3(matrix[3]), glm::normalize(glm::quat_cast(rotationMatrix)), scale);
+    }
+}
+
+void Skeleton::BuildLODs(){
+    // A node stays evaluated at a level while it is shallow enough, or while its subtree
+    // still moves enough of the skin. Both only shrink going down the hierarchy, so a
+    // masked node never has an evaluated child
+    const int maxDepth[MAX_SKELETON_LOD + 1] = { 1 << 30, 5, 4, 3 };
+    const float minCoverage[MAX_SKELETON_LOD + 1] = { 0.0f, 0.005f, 0.02f, 0.05f };
+    
+    size_t nodeCount = mNodes.size();
+    std::vector<int> depth(nodeCount, 0);
+    std::vector<float> subtreeCoverage(nodeCount, 0.0f);
+    for(size_t i=0; i<nodeCount; i++){
+        if(mNodes[i].parent >= 0){
+            depth[i] = depth[mNodes[i].parent] + 1;
+        }
+        if(mNodes[i].boneId >= 0 && mTotalSkinWeight > 0.0f){
+            subtreeCoverage[i] = mBoneSkinWeights[mNodes[i].boneId] / mTotalSkinWeight;
+        }
+    }
+    
+    // Children come after their parent, so walking backwards sums every subtree
+    for(size_t i=nodeCount; i-- > 1;){
+        if(mNodes[i].parent >= 0){
+            subtreeCoverage[mNodes[i].parent] += subtreeCoverage[i];
+        }
+    }
+    
+    mLODs.assign(MAX_SKELETON_LOD + 1, SkeletonLOD());
+    for(int level=0; level<=MAX_SKELETON_LOD; level++){
+        SkeletonLOD &lod = mLODs[level];
+        std::vector<int> ancestor(nodeCount, -1);               // Closest evaluated node, itself if evaluated
+        std::vector<glm::mat4> bindRelative(nodeCount, glm::mat4(1.0f));
+        
+        for(size_t i=0; i<nodeCount; i++){
+            const SkeletonNode &node = mNodes[i];
+            bool evaluated = node.parent < 0 || depth[i] <= maxDepth[level] || subtreeCoverage[i] >= minCoverage[level];
+            
+            if(evaluated){
+                ancestor[i] = (int)i;
+                lod.evaluatedNodes.push_back((int)i);
+                continue;
+            }
+            
+            // Chain the bind pose transforms down from the last evaluated ancestor
+            if(ancestor[node.parent] == node.parent){
+                bindRelative[i] = node.transformation;
+            }else{
+                bindRelative[i] = bindRelative[node.parent] * node.transformation;
+            }
+            ancestor[i] = ancestor[node.parent];
+            
+            if(node.boneId >= 0){
+                SkeletonLOD::MaskedBone masked;
+                masked.boneId = node.boneId;
+                masked.ancestor = ancestor[i];
+                masked.bindRelativeOffset = bindRelative[i] * mBoneOffsets[node.boneId];
+                lod.maskedBones.push_back(masked);
+            }
+        }
+        
+        PartitionLOD(lod);
+        LOGGER("Skeleton LOD "+std::to_string(level)+": "+std::to_string(lod.evaluatedNodes.size())+" of "+std::to_string(nodeCount)+" nodes evaluated, "+std::to_string(lod.subtreeRanges.size() - 1)+" subtree runs");
+    }
+}
+
+void Skeleton::PartitionLOD(SkeletonLOD &lod) const{
+    size_t nodeCount = mNodes.size();
+    size_t evaluatedCount = lod.evaluatedNodes.size();
+    
+    // Aim for a few runs per core on large rigs, without making tasks of a handful of nodes
+    const size_t minRunSize = 64;
+    const size_t runSize = std::max(minRunSize, evaluatedCount / 32);
+    
+    // Whole subtree of a node spans [i, subtreeEnd[i]) in depth-first order, and its
+    // evaluated nodes are a contiguous slice of evaluatedNodes
+    std::vector<int> subtreeEnd(nodeCount);
+    std::vector<int> evaluatedSize(nodeCount, 0);
+    for(size_t i=0; i<nodeCount; i++){
+        subtreeEnd[i] = (int)i + 1;
+    }
+    for(size_t n=0; n<evaluatedCount; n++){
+        evaluatedSize[lod.evaluatedNodes[n]] = 1;
+    }
+    for(size_t i=nodeCount; i-- > 1;){
+        int parent = mNodes[i].parent;
+        if(parent >= 0){
+            subtreeEnd[parent] = std::max(subtreeEnd[parent], subtreeEnd[i]);
+            evaluatedSize[parent] += evaluatedSize[i];
+        }
+    }
+    
+    // Going down from the root, the first node whose subtree is small enough starts a
+    // subtree, everything above is trunk
+    std::vector<int> trunk;
+    std::vector<int> subtrees;
+    std::vector<int> subtreeStarts;
+    for(size_t n=0; n<evaluatedCount;){
+        int node = lod.evaluatedNodes[n];
+        if(mNodes[node].parent < 0 || evaluatedSize[node] > (int)runSize){
+            trunk.push_back(node);
+            n++;
+            continue;
+        }
+        
+        subtreeStarts.push_back((int)subtrees.size());
+        while(n < evaluatedCount && lod.evaluatedNodes[n] < subtreeEnd[node]){
+            subtrees.push_back(lod.evaluatedNodes[n++]);
+        }
+    }
+    subtreeStarts.push_back((int)subtrees.size());
+    
+    // Pack neighbouring subtrees into runs of about runSize nodes
+    lod.trunkNodeCount = (int)trunk.size();
+    lod.subtreeRanges.assign(1, lod.trunkNodeCount);
+    for(size_t i=1; i<subtreeStarts.size(); i++){
+        bool lastSubtree = i + 1 == subtreeStarts.size();
+        int runStart = lod.subtreeRanges.back() - lod.trunkNodeCount;
+        if(lastSubtree || subtreeStarts[i] - runStart >= (int)runSize){
+            if(subtreeStarts[i] > runStart){
+                lod.subtreeRanges.push_back(lod.trunkNodeCount + subtreeStarts[i]);
+            }
+        }
+    }
+    
+    lod.evaluatedNodes.swap(trunk);
+    lod.evaluatedNodes.insert(lod.evaluatedNodes.end(), subtrees.begin(), subtrees.end());
+}
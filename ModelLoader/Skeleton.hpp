@@ -0,0 +1,120 @@
+//
+//  Skeleton.hpp
+//  ModelLoader
+//
+//  Created by Apple on 19/10/26.
+//
+
+#ifndef Skeleton_hpp
+#define Skeleton_hpp
+
+#include <stdio.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <stdint.h>
+#include <cassert>
+#include <glm/glm.hpp>
+
+#include "Logger.h"
+#include "LocalPose.hpp"
+#include "Bounds.hpp"
+
+// Number of reduced skeleton LOD levels, level 0 always evaluates every node
+#define MAX_SKELETON_LOD 3
+
+/* Node of the hierarchy flattened in depth-first order, so a parent is always stored
+    before its children */
+struct SkeletonNode{
+    int nameId;                 // Interned name, see Skeleton::GetName
+    int parent;                 // Index of the parent node, -1 for the root
+    glm::mat4 transformation;   // Bind pose transform relative to the parent
+    int boneId;                 // Index in finalBoneMatrices, -1 if no vertex is bound to the node
+};
+
+/* Nodes evaluated at one skeleton LOD level. Nodes that are masked off are not sampled,
+    they follow their closest evaluated ancestor rigidly with their bind pose transforms */
+struct SkeletonLOD{
+    struct MaskedBone{
+        int boneId;
+        int ancestor;                   // Closest evaluated ancestor node
+        glm::mat4 bindRelativeOffset;   // Bind pose transform from the ancestor, times the bone offset
+    };
+    
+    /* Parent first. The trunk comes first, then runs of whole subtrees that share no
+        node, so once the trunk is solved every run can be solved on its own thread */
+    std::vector<int> evaluatedNodes;
+    int trunkNodeCount = 0;
+    std::vector<int> subtreeRanges;     // Start of each run in evaluatedNodes, then evaluatedNodes.size()
+    std::vector<MaskedBone> maskedBones;
+};
+
+/* Node hierarchy and skinned bones of one character, shared by its Model, every clip
+    bound to it and every Animator playing those clips. Names are interned once and looked
+    up through a flat open addressing hash, so nothing downstream keys on strings */
+class Skeleton{
+public:
+    Skeleton();
+    
+    // -- Building, done by Model while loading
+    /* Registers a bone the skin references, returns its index in finalBoneMatrices */
+    int AddBone(const std::string &name, const glm::mat4 &offset);
+    /* Records a vertex the bone moves, position is in bind pose mesh space */
+    void AddSkinWeight(int boneId, float weight, const glm::vec3 &position);
+    /* Appends a node, children must be added after their parent */
+    int AddNode(const std::string &name, int parent, const glm::mat4 &transformation);
+    /* Links nodes to bones and builds the LOD levels, call once every node and bone is in */
+    void Finalize();
+    
+    // -- Lookups
+    int FindName(const char *name) const;               // -1 if the name was never interned
+    int FindNode(const char *name) const;               // -1 if no node has that name
+    int FindBone(const char *name) const;               // -1 if no bone has that name
+    const std::string& GetName(int nameId) const { return mNames[nameId]; }
+    /* Hash of the node names, parents and bone ids. Clip caches bound to a skeleton with
+        another layout are rejected by it */
+    uint32_t GetLayoutHash() const;
+    
+    // -- Getters
+    const std::vector<SkeletonNode>& GetNodes() const { return mNodes; }
+    int GetBoneCount() const { return (int)mBoneOffsets.size(); }
+    const glm::mat4& GetBoneOffset(int boneId) const { return mBoneOffsets[boneId]; }
+    float GetTotalSkinWeight() const { return mTotalSkinWeight; }
+    /* Bind pose box of the vertices each bone influences, per bone id. Moved by the
+        palette they bound the animated mesh, see SkinnedBounds */
+    const std::vector<AABB>& GetBoneBounds() const { return mBoneBounds; }
+    const SkeletonLOD& GetLOD(int level) const { return mLODs[std::max(0, std::min(level, MAX_SKELETON_LOD))]; }
+    /* Node transformations split into components, for nodes a clip has no keys for */
+    const LocalPose& GetBindPose() const { return mBindPose; }
+    
+    /* Per node blend mask covering the subtree under nodeName with weight and leaving
+        the rest at 0, padded like a LocalPose. All zero if there is no such node */
+    std::vector<float> MakeSubtreeMask(const char *nodeName, float weight = 1.0f) const;
+    
+private:
+    // Properties
+    // -- Interned names
+    std::vector<std::string> mNames;
+    std::vector<uint32_t> mNameHashes;
+    std::vector<int> mHashSlots;        // Name ids, -1 for an empty slot. Size is a power of two
+    std::vector<int> mNodeOfName;       // Per name id, -1 if none
+    std::vector<int> mBoneOfName;       // Per name id, -1 if none
+    
+    // -- Hierarchy and bones
+    std::vector<SkeletonNode> mNodes;
+    std::vector<glm::mat4> mBoneOffsets;
+    std::vector<float> mBoneSkinWeights;
+    std::vector<AABB> mBoneBounds;
+    float mTotalSkinWeight;
+    std::vector<SkeletonLOD> mLODs;
+    LocalPose mBindPose;
+    
+    // Functions
+    static uint32_t HashName(const char *name);
+    int InternName(const std::string &name);
+    void InsertHashSlot(int nameId);
+    void BuildBindPose();
+    void BuildLODs();
+    void PartitionLOD(SkeletonLOD &lod) const;
+};
+#endif /* Skeleton_hpp */
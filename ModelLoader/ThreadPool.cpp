@@ -0,0 +1,148 @@
+//
+//  ThreadPool.cpp
+//  ModelLoader
+//
+//  Created by Apple on 19/10/26.
+//
+
+#include "ThreadPool.hpp"
+
+ThreadPool::ThreadPool(unsigned int threadCount)
+        : mQueuedTasks(0), mStopping(false){
+    if(threadCount == 0){
+        unsigned int hardwareThreads = std::thread::hardware_concurrency();
+        threadCount = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+    }
+
+    for(unsigned int i=0; i<=threadCount; i++){
+        mQueues.push_back(std::unique_ptr<WorkQueue>(new WorkQueue()));
+    }
+
+    for(unsigned int i=0; i<threadCount; i++){
+        mWorkers.push_back(std::thread(&ThreadPool::WorkerLoop, this, i));
+    }
+}
+
+ThreadPool::~ThreadPool(){
+    {
+        std::lock_guard<std::mutex> lock(mSleepMutex);
+        mStopping = true;
+    }
+    mWakeCondition.notify_all();
+
+    for(unsigned int i=0; i<mWorkers.size(); i++){
+        mWorkers[i].join();
+    }
+}
+
+void ThreadPool::ParallelFor(size_t count, size_t grainSize, const RangeTask &task){
+    if(count == 0){
+        return;
+    }
+    if(grainSize == 0){
+        grainSize = 1;
+    }
+
+    size_t chunkCount = (count + grainSize - 1) / grainSize;
+
+    // Nothing to share, skip the queues altogether
+    if(chunkCount == 1 || mWorkers.empty()){
+        task(0, count);
+        return;
+    }
+
+    std::atomic<size_t> remaining(chunkCount);
+
+    // Counted before any chunk is queued, a worker already awake could otherwise pop one
+    // and decrement first, wrapping the count around
+    {
+        std::lock_guard<std::mutex> lock(mSleepMutex);
+        mQueuedTasks += chunkCount;
+    }
+
+    // Deal the chunks round-robin so every worker starts with its own share
+    size_t queueCount = mQueues.size();
+    for(size_t chunk=0; chunk<chunkCount; chunk++){
+        Task newTask;
+        newTask.function = &task;
+        newTask.begin = chunk * grainSize;
+        newTask.end = std::min(count, newTask.begin + grainSize);
+        newTask.remaining = &remaining;
+
+        WorkQueue &queue = *mQueues[chunk % queueCount];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(newTask);
+    }
+
+    mWakeCondition.notify_all();
+
+    // Help out until every chunk of this call has completed
+    size_t callerQueue = queueCount - 1;
+    while(remaining.load() > 0){
+        Task nextTask;
+        if(PopTask(callerQueue, nextTask)){
+            RunTask(nextTask);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mSleepMutex);
+        mDoneCondition.wait(lock, [&](){
+            return remaining.load() == 0 || mQueuedTasks.load() > 0;
+        });
+    }
+}
+
+bool ThreadPool::PopTask(size_t queueIndex, Task &task){
+    // Own queue first, newest task as it is the most likely to be warm in cache
+    {
+        WorkQueue &queue = *mQueues[queueIndex];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if(!queue.tasks.empty()){
+            task = queue.tasks.back();
+            queue.tasks.pop_back();
+            mQueuedTasks--;
+            return true;
+        }
+    }
+
+    // Then steal the oldest task of the other queues
+    size_t queueCount = mQueues.size();
+    for(size_t i=1; i<queueCount; i++){
+        WorkQueue &queue = *mQueues[(queueIndex + i) % queueCount];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if(!queue.tasks.empty()){
+            task = queue.tasks.front();
+            queue.tasks.pop_front();
+            mQueuedTasks--;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::RunTask(const Task &task){
+    (*task.function)(task.begin, task.end);
+
+    if(--(*task.remaining) == 0){
+        std::lock_guard<std::mutex> lock(mSleepMutex);
+        mDoneCondition.notify_all();
+    }
+}
+
+void ThreadPool::WorkerLoop(size_t queueIndex){
+    while(true){
+        Task task;
+        if(PopTask(queueIndex, task)){
+            RunTask(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mSleepMutex);
+        mWakeCondition.wait(lock, [&](){
+            return mStopping || mQueuedTasks.load() > 0;
+        });
+        if(mStopping){
+            return;
+        }
+    }
+}
@@ -0,0 +1,69 @@
+//
+//  ThreadPool.hpp
+//  ModelLoader
+//
+//  Created by Apple on 19/10/26.
+//
+
+#ifndef ThreadPool_hpp
+#define ThreadPool_hpp
+
+#include <stdio.h>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <algorithm>
+
+/* Fixed set of worker threads, each with its own task queue. A worker takes work from the
+    back of its own queue and steals from the front of the others once it runs dry, so
+    uneven chunks still spread over every core */
+class ThreadPool{
+public:
+    typedef std::function<void(size_t begin, size_t end)> RangeTask;
+
+    // -- Constructor and Destructor
+    // threadCount of 0 uses one worker per hardware thread, minus the calling thread
+    ThreadPool(unsigned int threadCount = 0);
+    ~ThreadPool();
+
+    /* Splits [0, count) into chunks of grainSize, spreads them over the worker queues and
+        blocks until every chunk has run. The calling thread works on the chunks too, so
+        it is safe to call from inside a task */
+    void ParallelFor(size_t count, size_t grainSize, const RangeTask &task);
+
+    // -- Getters
+    unsigned int GetThreadCount() const { return (unsigned int)mWorkers.size(); }
+
+private:
+    struct Task{
+        const RangeTask *function;
+        size_t begin;
+        size_t end;
+        std::atomic<size_t> *remaining;     // Chunks of the same ParallelFor still to finish
+    };
+
+    struct WorkQueue{
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    // Properties
+    std::vector<std::thread> mWorkers;
+    std::vector<std::unique_ptr<WorkQueue>> mQueues;    // One per worker, the last one is shared by callers
+    std::atomic<size_t> mQueuedTasks;
+    std::mutex mSleepMutex;
+    std::condition_variable mWakeCondition;
+    std::condition_variable mDoneCondition;
+    bool mStopping;
+
+    // Functions
+    bool PopTask(size_t queueIndex, Task &task);
+    void RunTask(const Task &task);
+    void WorkerLoop(size_t queueIndex);
+};
+#endif /* ThreadPool_hpp */
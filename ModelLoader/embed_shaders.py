@@ -0,0 +1,82 @@
+#!/usr/bin/env python3
+#
+#  embed_shaders.py
+#  ModelLoader
+#
+#  Created by Apple on 19/10/26.
+#
+#  Build step: writes every file under resources/shaders into a C++ include as a string
+#  literal, keyed by its path relative to the source root, with the FNV-1a hash of its
+#  text after includes are pasted in, as Shader::readSource does at runtime. An include
+#  that is not one of the embedded files fails the build, its edits would not change
+#  the hash.
+#  usage: embed_shaders.py <source root> <output .inc>
+
+import os
+import re
+import sys
+
+SHADER_DIRECTORY = "resources/shaders"
+DELIMITER = "glsl"
+
+def fnv1a64(data):
+    hash = 14695981039346656037
+    for byte in data:
+        hash ^= byte
+        hash = (hash * 1099511628211) & 0xFFFFFFFFFFFFFFFF
+    return hash
+
+def resolve(path, sources, included):
+    """Text of path with its includes pasted once each, the way Shader::readSource does"""
+    included.add(path)
+    directory = path[:path.rfind("/") + 1]
+    text = ""
+    # Lines keep their '\n', only '\n' ends a line
+    for line in re.findall(r'[^\n]*\n|[^\n]+$', sources[path]):
+        if line.lstrip(" \t").startswith("#include"):
+            match = re.search(r'"([^"]*)"', line)
+            if match:
+                includePath = directory + match.group(1)
+                if includePath not in sources:
+                    sys.exit("embed_shaders.py: " + path + " includes " + includePath + ", which is not an embedded shader")
+                if includePath not in included:
+                    text += resolve(includePath, sources, included)
+            continue
+        text += line
+    if text and not text.endswith("\n"):
+        text += "\n"
+    return text
+
+def main():
+    sourceRoot, outputPath = sys.argv[1], sys.argv[2]
+    
+    sources = {}
+    for directory, _, files in os.walk(os.path.join(sourceRoot, SHADER_DIRECTORY)):
+        for name in sorted(files):
+            if name.startswith("."):
+                continue
+            fullPath = os.path.join(directory, name)
+            with open(fullPath, "r", encoding="utf-8", newline="") as file:
+                sources[os.path.relpath(fullPath, sourceRoot)] = file.read()
+    
+    lines = ["// Generated by embed_shaders.py from " + SHADER_DIRECTORY + ", do not edit", "",
+             "static constexpr EmbeddedShader EMBEDDED_SHADERS[] = {"]
+    for path in sorted(sources):
+        source = sources[path]
+        if ")" + DELIMITER + "\"" in source:
+            sys.exit("embed_shaders.py: " + path + " contains the raw string delimiter")
+        hash = fnv1a64(resolve(path, sources, set()).encode("utf-8"))
+        lines.append('    { "%s", R"%s(%s)%s", %d, 0x%016xull },' % (path, DELIMITER, source, DELIMITER, len(source.encode("utf-8")), hash))
+    lines += ["};", ""]
+    output = "\n".join(lines)
+    
+    # Only touch the output when it changes, so unchanged shaders don't rebuild anything
+    if os.path.exists(outputPath):
+        with open(outputPath, "r") as file:
+            if file.read() == output:
+                return
+    with open(outputPath, "w") as file:
+        file.write(output)
+
+if __name__ == "__main__":
+    main()
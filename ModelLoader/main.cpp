@@ -16,6 +16,11 @@
 #include "Model.hpp"
 #include "Animator.hpp"
 #include "Animation.hpp"
+#include "AnimationTexture.hpp"
+#include "Benchmark.hpp"
+#include "AnimationLOD.hpp"
+#include "GpuAnimation.hpp"
+#include "ShaderVariants.hpp"
 
 const int SCREEN_WIDTH = 800;
 const int SCREEN_HEIGHT = 600;
@@ -42,6 +47,31 @@ float lastFrame = 0.0f;
 
 int main(int argc, const char * argv[]) {
     LOGGER("Starting application");
+    
+    // --crowd N draws N vampires from the baked animation texture instead of a single one
+    // --gpu-crowd N samples the N vampires in a compute shader instead (GL 4.3)
+    // --validate-gpu-sampling compares the compute shader palettes with the CPU and exits
+    // --preskin skins the vampire once per frame with transform feedback, passes draw the result statically
+    // --benchmark runs the CPU benchmarks and exits without opening a window
+    int crowdSize = 0;
+    bool preskin = false;
+    bool gpuSampling = false;
+    bool validateGpuSampling = false;
+    for(int i=1; i<argc; i++){
+        if(std::string(argv[i]) == "--crowd" && i+1 < argc){
+            crowdSize = std::atoi(argv[++i]);
+        }else if(std::string(argv[i]) == "--gpu-crowd" && i+1 < argc){
+            crowdSize = std::atoi(argv[++i]);
+            gpuSampling = true;
+        }else if(std::string(argv[i]) == "--validate-gpu-sampling"){
+            validateGpuSampling = true;
+        }else if(std::string(argv[i]) == "--preskin"){
+            preskin = true;
+        }else if(std::string(argv[i]) == "--benchmark"){
+            Benchmark::RunAll();
+            return 0;
+        }
+    }
     //Initialize GLFW
     if(!glfwInit()){
         LOGGER("Failed to initialise GLFW! Terminating GLFW.");
@@ -50,8 +80,9 @@ int main(int argc, const char * argv[]) {
     }
     LOGGER("GLFW initialised.");
     
-    // OpenGL version 3.3
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    // OpenGL version 3.3, or 4.3 when compute shaders are needed
+    bool needsCompute = gpuSampling || validateGpuSampling;
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, needsCompute ? 4 : 3);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
     
@@ -62,6 +93,13 @@ int main(int argc, const char * argv[]) {
     LOGGER("OpenGL properties set with OpenGL version 3.3");
     
     GLFWwindow* window = glfwCreateWindow(SCREEN_WIDTH, SCREEN_HEIGHT, "Breakout", nullptr, nullptr);
+    if(!window && needsCompute){
+        // macOS stops at 4.1, the crowd falls back to the baked texture
+        LOGGER("No OpenGL 4.3 context, GPU sampling disabled. Retrying with OpenGL 3.3");
+        gpuSampling = false;
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        window = glfwCreateWindow(SCREEN_WIDTH, SCREEN_HEIGHT, "Breakout", nullptr, nullptr);
+    }
     if(!window){
         LOGGER("Failed to create GLFW Window! Terminating GLFW.");
         glfwTerminate();
@@ -99,51 +137,229 @@ int main(int argc, const char * argv[]) {
     //glfwSetWindowUserPointer(window, this);
     LOGGER("Window Initialisation Completed.");
     
-    Shader ourShader("resources/shaders/model_loading.vs", "resources/shaders/model_loading.fs");
+    // Static meshes and every specialisation of the animated ones come from mesh.vs
+    ShaderVariants meshShaders("resources/shaders/mesh.vs", "resources/shaders/model_loading.fs");
+    Shader &ourShader = meshShaders.Get(0);
     Model ourModel("resources/models/backpack/backpack.obj");
     
     // Animation data
-    Shader animationShader("resources/shaders/animation.vs", "resources/shaders/animation.fs");
     Model animatedModel("resources/models/vampire/dancing_vampire.dae");
+    animatedModel.skinningMode = SKINNING_LINEAR;   // SKINNING_DUAL_QUATERNION halves the palette upload
+    // One variant per influence bucket the model uses, issued now so they compile while the
+    // clips load. The PALETTE_BLEND ones are left to compile on first use
+    unsigned int skinningFeatures = animatedModel.skinningMode == SKINNING_DUAL_QUATERNION ? SHADER_FEATURE_DUAL_QUATERNION : SHADER_FEATURE_SKINNED;
+    if(animatedModel.HasMorphTargets()){
+        skinningFeatures |= SHADER_FEATURE_MORPH_TARGETS;
+    }
+    for(int i=0; i<INFLUENCE_BUCKET_COUNT; i++){
+        if(animatedModel.HasInfluenceBucket(INFLUENCE_BUCKETS[i])){
+            meshShaders.Prepare(skinningFeatures | Shader::InfluenceFeature(INFLUENCE_BUCKETS[i]));
+        }
+    }
     Animation danceAnimation("resources/models/vampire/dancing_vampire.dae", &animatedModel);
     Animator animator(&danceAnimation);
+    animator.SetSkinningMode(animatedModel.skinningMode);
+    
+    // Pre-skinning only covers linear blend skinning
+    preskin = preskin && animatedModel.skinningMode == SKINNING_LINEAR;
+    Shader morphScatterShader("resources/shaders/morph_scatter.vs", "resources/shaders/morph_scatter.fs");
+    Shader skinningFeedbackShader("resources/shaders/skinning_feedback.vs", std::vector<const char*>{"skinnedPosition", "skinnedNormal"});
+    
+    if(validateGpuSampling){
+        bool passed = false;
+        if(GpuAnimation::IsSupported()){
+            std::vector<float> instanceTimes;
+            for(int i=0; i<256; i++){
+                instanceTimes.push_back(i * 0.173f);
+            }
+            GpuAnimation gpuAnimation(&danceAnimation, (int)instanceTimes.size());
+            float maxError = gpuAnimation.ValidateAgainstCPU(instanceTimes);
+            passed = maxError < 1e-2f;  // Rotations are uploaded as half floats
+            std::cout << "GPU sampling max relative error " << maxError << (passed ? ", passed" : ", FAILED") << std::endl;
+        }else{
+            std::cout << "GPU sampling needs compute shaders, FAILED" << std::endl;
+        }
+        glfwDestroyWindow(window);
+        glfwTerminate();
+        return passed ? 0 : 1;
+    }
+    
+    // Large rigs solve their subtrees on the workers
+    ThreadPool workerPool;
+    animator.SetThreadPool(&workerPool);
+    float lastTimingReport = 0.0f;
+    float lastStateReport = 0.0f;
+    
+    // Animation LOD, distant characters are sampled less often
+    AnimationLODPolicy lodPolicy;
+    
+    // Crowd data
+    Shader crowdShader("resources/shaders/animation_baked.vs", "resources/shaders/animation.fs");
+    std::vector<const Animation*> crowdClips(1, &danceAnimation);
+    AnimationTexture crowdAnimation(crowdClips, animatedModel.GetBoneCount());
+    std::unique_ptr<GpuAnimation> gpuCrowdAnimation;
+    Shader gpuCrowdShader("resources/shaders/animation_compute.vs", "resources/shaders/animation.fs");
+    if(gpuSampling && GpuAnimation::IsSupported()){
+        gpuCrowdAnimation.reset(new GpuAnimation(&danceAnimation, crowdSize));
+    }
+    std::vector<float> crowdTimes(crowdSize, 0.0f);
+    std::vector<InstanceData> crowd;
+    int crowdColumns = (int)ceil(sqrt((float)crowdSize));
+    for(int i=0; i<crowdSize; i++){
+        InstanceData instance;
+        instance.model = glm::translate(glm::mat4(1.0f), glm::vec3((i % crowdColumns) * 1.5f, 0.0f, -(i / crowdColumns) * 1.5f));
+        instance.animation = glm::vec2(0.0f, i * 0.37f);    // Offset the start so the crowd doesn't move in lockstep
+        crowd.push_back(instance);
+    }
+    
+    // Programs compiled while the models and clips loaded, only wait for the stragglers
+    Shader::FinishPendingPrograms();
     
     while(!glfwWindowShouldClose(window)){
         // Calculat Delta time
         float currentTime = glfwGetTime();
         deltaTime = currentTime - lastFrame;
         lastFrame = currentTime;
+        
+        // Binds of the previous frame, every path below ends its frame early
+        if(currentTime - lastStateReport > 5.0f){
+            LOGGER("GL binds issued/requested per frame: "+GLState::FormatCounters());
+            lastStateReport = currentTime;
+        }
+        GLState::ResetCounters();
 
         // input
         // -----
         processInput(window);
-        animator.UpdateAnimation(deltaTime);
         
         // Render
         glClearColor(0.0f, 0.0f, 1.0f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-       
-        animationShader.use();
         
         // view/projection transformations
         glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCREEN_WIDTH / (float)SCREEN_HEIGHT, 0.1f, 100.0f);
         glm::mat4 view = camera.GetViewMatrix();
-        animationShader.setMatrix4("projection", projection);
-        animationShader.setMatrix4("view", view);
         
-        auto transforms = animator.GetFinalBoneMatrices();
-        for(int i=0; i<transforms.size(); i++){
-            std::string str = std::to_string(i);
-            std::string uniformTransformation = std::string("finalBonesMatrices[")+ str +std::string("]");
-            animationShader.setMatrix4(uniformTransformation.c_str(), transforms[i]);
+        if(crowdSize > 0 && gpuCrowdAnimation){
+            // Every instance is sampled and solved in the compute shader
+            for(int i=0; i<crowdSize; i++){
+                crowdTimes[i] = currentTime + crowd[i].animation.y;
+            }
+            gpuCrowdAnimation->Dispatch(crowdTimes);
+            
+            gpuCrowdShader.use();
+            gpuCrowdShader.setMatrix4("projection", projection);
+            gpuCrowdShader.setMatrix4("view", view);
+            gpuCrowdAnimation->Bind(gpuCrowdShader, 4);
+            animatedModel.drawInstanced(gpuCrowdShader, crowd);
+            
+            glfwSwapBuffers(window);
+            glfwPollEvents();
+            continue;
+        }
+        
+        if(crowdSize > 0){
+            // No CPU animation at all, every instance samples the baked texture
+            crowdShader.use();
+            crowdShader.setMatrix4("projection", projection);
+            crowdShader.setMatrix4("view", view);
+            crowdShader.setFloat("time", currentTime);
+            crowdAnimation.Bind(crowdShader, 4);
+            animatedModel.drawInstanced(crowdShader, crowd);
+            
+            glfwSwapBuffers(window);
+            glfwPollEvents();
+            continue;
         }
         
         // render the loaded model
         glm::mat4 model = glm::mat4(1.0f);
         model = glm::translate(model, glm::vec3(0.0f, 0.0f, 0.0f)); // translate it down so it's at the center of the scene
         model = glm::scale(model, glm::vec3(1.0f, 1.0f, 1.0f));    // it's a bit too big for our scene, so scale it down
-        animationShader.setMatrix4("model", model);
-        animatedModel.draw(animationShader);
+        
+        // Bounds of the last evaluated pose, tight enough for culling and for the LOD screen size
+        AABB animatedBounds = animator.ComputeBounds().Transformed(model);
+        glm::vec3 modelCenter = animatedBounds.GetCenter();
+        float animatedModelRadius = animatedBounds.GetRadius();
+        animator.SetUpdateInterval(AnimationLOD::ComputeUpdateInterval(lodPolicy, modelCenter, animatedModelRadius, view, projection));
+        animator.SetSkeletonLOD(AnimationLOD::ComputeSkeletonLOD(lodPolicy, AnimationLOD::ComputeScreenSize(modelCenter, animatedModelRadius, view, projection)));
+        animator.UpdateAnimation(deltaTime);
+        
+        const std::vector<float> &subtreeTimings = animator.GetSubtreeTimings();
+        if(!subtreeTimings.empty() && currentTime - lastTimingReport > 5.0f){
+            std::string report;
+            for(size_t i=0; i<subtreeTimings.size(); i++){
+                report += " " + std::to_string(subtreeTimings[i]);
+            }
+            LOGGER("Subtree solve times (ms):"+report);
+            lastTimingReport = currentTime;
+        }
+        
+        // Blend shape weights set through animatedModel.SetMorphWeight take effect here
+        animatedModel.applyMorphTargets(morphScatterShader);
+        
+        if(preskin){
+            // Skin once, every pass drawing the vampire this frame reuses the skinned vertices
+            PaletteSet palettes;
+            palettes.boneMatrices = &animator.GetFinalBoneMatrices();
+            animatedModel.skin(skinningFeedbackShader, palettes);
+            
+            ourShader.use();
+            ourShader.setMatrix4("projection", projection);
+            ourShader.setMatrix4("view", view);
+            ourShader.setMatrix4("model", model);
+            animatedModel.drawSkinned(ourShader);
+        }else{
+            // Reduced rate animators interpolate between their last two palettes
+            bool interpolatePalettes = animator.GetUpdateInterval() > 1 && animator.GetSkinningMode() == SKINNING_LINEAR;
+            
+            // One draw per influence bucket, each with the variant compiled for its influence count
+            for(int bucket=0; bucket<INFLUENCE_BUCKET_COUNT; bucket++){
+                int influenceCount = INFLUENCE_BUCKETS[bucket];
+                if(!animatedModel.HasInfluenceBucket(influenceCount)){
+                    continue;
+                }
+                
+                unsigned int features = skinningFeatures | Shader::InfluenceFeature(influenceCount);
+                if(interpolatePalettes){
+                    features |= SHADER_FEATURE_PALETTE_BLEND;
+                }
+                Shader &skinningShader = meshShaders.Get(features);
+                skinningShader.use();
+                skinningShader.setMatrix4("projection", projection);
+                skinningShader.setMatrix4("view", view);
+                
+                // Each mesh uploads the slice of the palettes it references
+                PaletteSet palettes;
+                if(animator.GetSkinningMode() == SKINNING_DUAL_QUATERNION){
+                    palettes.boneDualQuaternions = &animator.GetFinalBoneDualQuaternions();
+                }else{
+                    palettes.boneMatrices = &animator.GetFinalBoneMatrices();
+                }
+                if(interpolatePalettes){
+                    palettes.previousBoneMatrices = &animator.GetPreviousBoneMatrices();
+                    skinningShader.setFloat("paletteBlend", animator.GetPaletteBlend());
+                }
+                
+                skinningShader.setMatrix4("model", model);
+                animatedModel.drawDeformable(skinningShader, palettes, influenceCount);
+            }
+            
+            // Triangles following a single bone skip the influence loop, their matrices are
+            // blended on the CPU when the palettes are interpolated
+            std::vector<glm::mat4> rigidPalette = animator.GetFinalBoneMatrices();
+            if(interpolatePalettes){
+                const auto &previousTransforms = animator.GetPreviousBoneMatrices();
+                float blend = animator.GetPaletteBlend();
+                for(size_t i=0; i<rigidPalette.size() && i<previousTransforms.size(); i++){
+                    rigidPalette[i] = previousTransforms[i] * (1.0f - blend) + rigidPalette[i] * blend;
+                }
+            }
+            ourShader.use();
+            ourShader.setMatrix4("projection", projection);
+            ourShader.setMatrix4("view", view);
+            animatedModel.drawRigid(ourShader, rigidPalette, model);
+        }
 
         glfwSwapBuffers(window);
         glfwPollEvents();
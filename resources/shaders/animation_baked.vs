@@ -0,0 +1,80 @@
+#version 330 core
+
+// In Attributes
+layout(location = 0) in vec3 aPos;  // Vertex Position
+layout(location = 1) in vec3 aNorm; // Normal Position
+layout(location = 2) in vec2 aTexCoords;    // Texture Coordinate
+layout(location = 3) in ivec4 boneIds;      // Bone Ids
+layout(location = 4) in vec4 weights;       // Weights of the muscles
+layout(location = 5) in ivec4 boneIds2;     // Bone Ids of influences 5 to 8
+layout(location = 6) in vec4 weights2;      // Their weights
+
+// Per instance Attributes
+layout(location = 8) in mat4 instanceModel;         // Takes locations 8 to 11
+layout(location = 12) in vec2 instanceAnimation;    // x = clip index, y = time offset in seconds
+
+// Uniforms
+uniform mat4 projection;
+uniform mat4 view;
+uniform float time;                 // Seconds, shared by all instances
+
+const int MAX_BONES = 100;
+const int MAX_BONE_INFLUENCE = 8;
+uniform int paletteBones[MAX_BONES];    // Skeleton bone of each of the mesh's palette slots
+const int MAX_BAKED_CLIPS = 16;
+uniform sampler2D bakedBones;       // One row per frame, 3 texels per bone
+uniform float bakedSampleRate;      // Frames per second
+uniform vec2 bakedClips[MAX_BAKED_CLIPS];   // x = first frame, y = frame count
+
+// Out Parameters
+out vec2 TexCoords;
+
+// Slot i of the 8 influences, split over two attributes
+int influenceBone(int i){
+    return i < 4 ? boneIds[i] : boneIds2[i - 4];
+}
+
+float influenceWeight(int i){
+    return i < 4 ? weights[i] : weights2[i - 4];
+}
+
+// Rebuilds the bone matrix from the 3 stored rows
+mat4 fetchBoneMatrix(int frame, int boneId){
+    vec4 row0 = texelFetch(bakedBones, ivec2(boneId * 3 + 0, frame), 0);
+    vec4 row1 = texelFetch(bakedBones, ivec2(boneId * 3 + 1, frame), 0);
+    vec4 row2 = texelFetch(bakedBones, ivec2(boneId * 3 + 2, frame), 0);
+    return transpose(mat4(row0, row1, row2, vec4(0.0f, 0.0f, 0.0f, 1.0f)));
+}
+
+void main(){
+    // Find the two baked frames around this instance's time
+    vec2 clip = bakedClips[int(instanceAnimation.x)];
+    float clipFrame = mod((time + instanceAnimation.y) * bakedSampleRate, clip.y);
+    int frame0 = int(floor(clipFrame));
+    int frame1 = int(mod(float(frame0 + 1), clip.y));
+    float blend = clipFrame - float(frame0);
+    frame0 += int(clip.x);
+    frame1 += int(clip.x);
+    
+    vec4 totalPosition = vec4(0.0f);
+    for(int i=0; i<MAX_BONE_INFLUENCE; i++){
+        int slot = influenceBone(i);
+        if(slot == -1){
+            continue;
+        }
+        
+        if(slot >= MAX_BONES){
+            totalPosition = vec4(aPos, 1.0f);
+            break;
+        }
+        
+        // mix() has no matrix overload, blend the two frames by hand
+        int boneId = paletteBones[slot];
+        mat4 boneMatrix = fetchBoneMatrix(frame0, boneId) * (1.0f - blend) + fetchBoneMatrix(frame1, boneId) * blend;
+        vec4 localPosition = boneMatrix * vec4(aPos, 1.0f);
+        totalPosition += localPosition * influenceWeight(i);
+    }
+    
+    gl_Position = projection * view * instanceModel * totalPosition;
+    TexCoords = aTexCoords;
+}
@@ -0,0 +1,65 @@
+#version 330 core
+
+// In Attributes
+layout(location = 0) in vec3 aPos;  // Vertex Position
+layout(location = 1) in vec3 aNorm; // Normal Position
+layout(location = 2) in vec2 aTexCoords;    // Texture Coordinate
+layout(location = 3) in ivec4 boneIds;      // Bone Ids
+layout(location = 4) in vec4 weights;       // Weights of the muscles
+layout(location = 5) in ivec4 boneIds2;     // Bone Ids of influences 5 to 8
+layout(location = 6) in vec4 weights2;      // Their weights
+
+// Per instance Attributes
+layout(location = 8) in mat4 instanceModel;         // Takes locations 8 to 11
+
+// Uniforms
+uniform mat4 projection;
+uniform mat4 view;
+
+const int MAX_BONES = 100;
+const int MAX_BONE_INFLUENCE = 8;
+uniform int paletteBones[MAX_BONES];    // Skeleton bone of each of the mesh's palette slots
+uniform samplerBuffer instancePalettes;     // Written by animation_sample.cs, 3 texels per bone
+uniform int paletteBoneCount;
+
+// Out Parameters
+out vec2 TexCoords;
+
+// Slot i of the 8 influences, split over two attributes
+int influenceBone(int i){
+    return i < 4 ? boneIds[i] : boneIds2[i - 4];
+}
+
+float influenceWeight(int i){
+    return i < 4 ? weights[i] : weights2[i - 4];
+}
+
+// Rebuilds the bone matrix from the 3 stored rows
+mat4 fetchBoneMatrix(int boneId){
+    int base = (gl_InstanceID * paletteBoneCount + boneId) * 3;
+    vec4 row0 = texelFetch(instancePalettes, base + 0);
+    vec4 row1 = texelFetch(instancePalettes, base + 1);
+    vec4 row2 = texelFetch(instancePalettes, base + 2);
+    return transpose(mat4(row0, row1, row2, vec4(0.0f, 0.0f, 0.0f, 1.0f)));
+}
+
+void main(){
+    vec4 totalPosition = vec4(0.0f);
+    for(int i=0; i<MAX_BONE_INFLUENCE; i++){
+        int slot = influenceBone(i);
+        if(slot == -1){
+            continue;
+        }
+        
+        if(slot >= MAX_BONES){
+            totalPosition = vec4(aPos, 1.0f);
+            break;
+        }
+        
+        vec4 localPosition = fetchBoneMatrix(paletteBones[slot]) * vec4(aPos, 1.0f);
+        totalPosition += localPosition * influenceWeight(i);
+    }
+    
+    gl_Position = projection * view * instanceModel * totalPosition;
+    TexCoords = aTexCoords;
+}
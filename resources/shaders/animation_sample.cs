@@ -0,0 +1,174 @@
+#version 430 core
+
+// One invocation per instance: samples every track of the clip at the instance's time,
+// solves the flattened hierarchy and writes the palette
+layout(local_size_x = 64) in;
+
+struct Node{
+    int parent;
+    int firstTrack;     // Position track, rotation and scale follow. -1 for the bind pose
+    int boneId;
+    int padding;
+    vec4 translation;   // Bind pose
+    vec4 rotation;
+    vec4 scale;
+};
+
+struct Track{
+    int type;
+    int firstKey;
+    int keyCount;
+    int firstTime;      // -1 when no time is stored
+    float inverseInterval;
+    float startTime;
+    float padding0;
+    float padding1;
+};
+
+layout(std430, binding = 0) readonly buffer Nodes{ Node nodes[]; };
+layout(std430, binding = 1) readonly buffer BoneOffsets{ mat4 boneOffsets[]; };
+layout(std430, binding = 2) readonly buffer Tracks{ Track tracks[]; };
+layout(std430, binding = 3) readonly buffer KeyFloats{ float keyFloats[]; };
+layout(std430, binding = 4) readonly buffer RotationKeys{ uvec2 rotationKeys[]; };
+layout(std430, binding = 5) readonly buffer InstanceTimes{ float instanceTimes[]; };
+layout(std430, binding = 6) writeonly buffer Palettes{ vec4 palettes[]; };
+layout(std430, binding = 7) buffer GlobalTransforms{ mat4 globalTransforms[]; };
+
+uniform int instanceCount;
+uniform int nodeCount;
+uniform int boneCount;
+uniform float ticksPerSecond;
+uniform float duration;             // Ticks
+
+// Must match TrackType in Bone.hpp
+const int TRACK_CONSTANT = 0;
+const int TRACK_STEP = 1;
+const int TRACK_LINEAR = 2;
+const int TRACK_UNIFORM = 3;
+
+// Key at or before time, and how far to move towards the next one
+void findKeys(Track track, float time, out int key, out float factor){
+    key = 0;
+    factor = 0.0f;
+    if(track.type == TRACK_CONSTANT){
+        return;
+    }
+    if(track.type == TRACK_UNIFORM){
+        float keyTime = max(0.0f, (time - track.startTime) * track.inverseInterval);
+        key = min(int(keyTime), track.keyCount - 2);
+        factor = min(keyTime - float(key), 1.0f);
+        return;
+    }
+    
+    // Binary search, a per instance cursor would cost more memory than it saves
+    int low = 0;
+    int high = track.keyCount - 2;
+    while(low < high){
+        int middle = (low + high + 1) / 2;
+        if(keyFloats[track.firstTime + middle] <= time){
+            low = middle;
+        }else{
+            high = middle - 1;
+        }
+    }
+    key = low;
+    
+    float time0 = keyFloats[track.firstTime + key];
+    float time1 = keyFloats[track.firstTime + key + 1];
+    if(track.type == TRACK_STEP){
+        factor = time >= time1 ? 1.0f : 0.0f;
+    }else{
+        factor = clamp((time - time0) / (time1 - time0), 0.0f, 1.0f);
+    }
+}
+
+vec3 vectorKey(Track track, int key){
+    int index = track.firstKey + key * 3;
+    return vec3(keyFloats[index], keyFloats[index + 1], keyFloats[index + 2]);
+}
+
+vec4 rotationKey(Track track, int key){
+    uvec2 keyBits = rotationKeys[track.firstKey + key];
+    return vec4(unpackHalf2x16(keyBits.x), unpackHalf2x16(keyBits.y));
+}
+
+vec3 sampleVector(Track track, float time){
+    int key;
+    float factor;
+    findKeys(track, time, key, factor);
+    if(factor == 0.0f){
+        return vectorKey(track, key);
+    }
+    return mix(vectorKey(track, key), vectorKey(track, key + 1), factor);
+}
+
+// Same as glm::slerp, shortest path and a plain lerp for nearly equal rotations
+vec4 slerp(vec4 from, vec4 to, float factor){
+    float cosine = dot(from, to);
+    if(cosine < 0.0f){
+        to = -to;
+        cosine = -cosine;
+    }
+    if(cosine > 0.9999f){
+        return mix(from, to, factor);
+    }
+    float angle = acos(cosine);
+    return (sin((1.0f - factor) * angle) * from + sin(factor * angle) * to) / sin(angle);
+}
+
+vec4 sampleRotation(Track track, float time){
+    int key;
+    float factor;
+    findKeys(track, time, key, factor);
+    if(factor == 0.0f){
+        return normalize(rotationKey(track, key));
+    }
+    return normalize(slerp(rotationKey(track, key), rotationKey(track, key + 1), factor));
+}
+
+// translation * rotation * scale
+mat4 compose(vec3 translation, vec4 rotation, vec3 scale){
+    float x = rotation.x, y = rotation.y, z = rotation.z, w = rotation.w;
+    vec3 column0 = vec3(1.0f - 2.0f * (y * y + z * z), 2.0f * (x * y + w * z), 2.0f * (x * z - w * y));
+    vec3 column1 = vec3(2.0f * (x * y - w * z), 1.0f - 2.0f * (x * x + z * z), 2.0f * (y * z + w * x));
+    vec3 column2 = vec3(2.0f * (x * z + w * y), 2.0f * (y * z - w * x), 1.0f - 2.0f * (x * x + y * y));
+    return mat4(vec4(column0 * scale.x, 0.0f), vec4(column1 * scale.y, 0.0f), vec4(column2 * scale.z, 0.0f), vec4(translation, 1.0f));
+}
+
+void main(){
+    int instance = int(gl_GlobalInvocationID.x);
+    if(instance >= instanceCount){
+        return;
+    }
+    
+    float time = mod(instanceTimes[instance] * ticksPerSecond, duration);
+    int globalBase = instance * nodeCount;
+    int paletteBase = instance * boneCount * 3;
+    
+    // Nodes are stored parent first, so a single forward pass resolves the hierarchy
+    for(int i=0; i<nodeCount; i++){
+        Node node = nodes[i];
+        vec3 translation = node.translation.xyz;
+        vec4 rotation = node.rotation;
+        vec3 scale = node.scale.xyz;
+        if(node.firstTrack >= 0){
+            translation = sampleVector(tracks[node.firstTrack], time);
+            rotation = sampleRotation(tracks[node.firstTrack + 1], time);
+            scale = sampleVector(tracks[node.firstTrack + 2], time);
+        }
+        
+        mat4 globalTransform = compose(translation, rotation, scale);
+        if(node.parent >= 0){
+            globalTransform = globalTransforms[globalBase + node.parent] * globalTransform;
+        }
+        globalTransforms[globalBase + i] = globalTransform;
+        
+        // Same 3 row layout as the baked animation texture
+        if(node.boneId >= 0){
+            mat4 boneMatrix = transpose(globalTransform * boneOffsets[node.boneId]);
+            palettes[paletteBase + node.boneId * 3 + 0] = boneMatrix[0];
+            palettes[paletteBase + node.boneId * 3 + 1] = boneMatrix[1];
+            palettes[paletteBase + node.boneId * 3 + 2] = boneMatrix[2];
+        }
+    }
+}
@@ -0,0 +1,46 @@
+// Bone attributes shared by both skinning methods. The including file defines
+// addInfluence, addInfluences calls it for each of the BONE_INFLUENCES slots
+
+#if defined(SKINNED) || defined(DUAL_QUATERNION)
+#ifndef BONE_INFLUENCES
+#define BONE_INFLUENCES 4
+#endif
+
+layout(location = 3) in ivec4 boneIds;      // Bone Ids
+layout(location = 4) in vec4 weights;       // Weights of the muscles
+#if BONE_INFLUENCES > 4
+layout(location = 5) in ivec4 boneIds2;     // Bone Ids of influences 5 to 8
+layout(location = 6) in vec4 weights2;      // Their weights
+#endif
+
+const int MAX_BONES = 100;
+
+void addInfluence(int boneId, float weight);
+
+// Unused slots hold -1 with weight 0, so every slot of the bucket is read without a branch
+void addInfluences(){
+    addInfluence(boneIds[0], weights[0]);
+#if BONE_INFLUENCES >= 2
+    addInfluence(boneIds[1], weights[1]);
+#endif
+#if BONE_INFLUENCES >= 4
+    addInfluence(boneIds[2], weights[2]);
+    addInfluence(boneIds[3], weights[3]);
+#endif
+#if BONE_INFLUENCES > 4
+    for(int i=0; i<4; i++){
+        addInfluence(boneIds2[i], weights2[i]);
+    }
+#endif
+}
+
+// Slots past the palette come from a mesh the loader could not split below MAX_BONES,
+// such vertices keep their bind pose as they do in CpuSkinning
+bool influencesInPalette(){
+    bool inPalette = all(lessThan(boneIds, ivec4(MAX_BONES)));
+#if BONE_INFLUENCES > 4
+    inPalette = inPalette && all(lessThan(boneIds2, ivec4(MAX_BONES)));
+#endif
+    return inPalette;
+}
+#endif
@@ -0,0 +1,45 @@
+#version 330 core
+
+// Every forward pass mesh, static or animated. The loader specialises it with the defines
+// of its ShaderFeature bits, see ShaderVariants:
+//  SKINNED or DUAL_QUATERNION  Linear blend or dual quaternion skinning, neither for static meshes
+//  BONE_INFLUENCES             1, 2, 4 or 8, the influence bucket of the meshes drawn
+//  PALETTE_BLEND               Blends with the previous palette, for reduced rate animators
+//  MORPH_TARGETS               Adds the summed blend shape offsets before skinning
+//  INSTANCED                   Model matrix per instance instead of the model uniform
+
+// In Attributes
+layout(location = 0) in vec3 aPos;  // Vertex Position
+layout(location = 1) in vec3 aNorm; // Normal Position
+layout(location = 2) in vec2 aTexCoords;    // Texture Coordinate
+
+// Uniforms
+uniform mat4 projection;
+uniform mat4 view;
+#ifdef INSTANCED
+layout(location = 8) in mat4 instanceModel;         // Takes locations 8 to 11
+#define MODEL_MATRIX instanceModel
+#else
+uniform mat4 model;
+#define MODEL_MATRIX model
+#endif
+
+// Out Parameters
+out vec2 TexCoords;
+
+// Each file is guarded by its own define
+#include "morph_targets.glsl"
+#include "bone_influences.glsl"
+#include "skinning_linear.glsl"
+#include "skinning_dual_quaternion.glsl"
+
+void main(){
+    vec4 position = morphPosition();
+#if defined(SKINNED) || defined(DUAL_QUATERNION)
+    position = skinPosition(position);
+#endif
+    
+    mat4 viewModel = view * MODEL_MATRIX;
+    gl_Position = projection * viewModel * position;
+    TexCoords = aTexCoords;
+}
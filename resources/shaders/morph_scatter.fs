@@ -0,0 +1,9 @@
+#version 330 core
+
+in vec3 offset;
+
+out vec4 FragColor;
+
+void main(){
+    FragColor = vec4(offset, 0.0f);
+}
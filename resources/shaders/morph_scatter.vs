@@ -0,0 +1,25 @@
+#version 330 core
+
+// Adds the weighted deltas of one blend shape into the morph offsets texture, one point per
+// delta and texel drawn with additive blending. Instance 0 writes the position offset,
+// instance 1 the normal offset
+
+// In Attributes
+layout(location = 0) in uint vertexIndex;     // Vertex the delta moves
+layout(location = 1) in vec3 positionDelta;
+layout(location = 2) in vec3 normalDelta;
+
+// Uniforms
+const int MORPH_TEXTURE_WIDTH = 1024;
+uniform vec2 morphTextureSize;      // In texels
+uniform float morphWeight;
+
+// Out Parameters
+out vec3 offset;
+
+void main(){
+    int texel = int(vertexIndex) * 2 + gl_InstanceID;
+    vec2 pixel = vec2(texel % MORPH_TEXTURE_WIDTH, texel / MORPH_TEXTURE_WIDTH) + 0.5f;
+    gl_Position = vec4(pixel / morphTextureSize * 2.0f - 1.0f, 0.0f, 1.0f);
+    offset = (gl_InstanceID == 0 ? positionDelta : normalDelta) * morphWeight;
+}
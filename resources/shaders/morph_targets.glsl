@@ -0,0 +1,20 @@
+// Blend shapes, included after aPos is declared
+
+#ifdef MORPH_TARGETS
+// Summed offsets of the active blend shapes, position then normal, 2 texels per vertex
+const int MORPH_TEXTURE_WIDTH = 1024;
+uniform sampler2D morphOffsets;
+uniform bool morphEnabled;          // False for the meshes without blend shapes
+#endif
+
+// Bind pose position, moved by the blend shapes when there are any
+vec4 morphPosition(){
+    vec4 position = vec4(aPos, 1.0f);
+#ifdef MORPH_TARGETS
+    if(morphEnabled){
+        int texel = gl_VertexID * 2;
+        position.xyz += texelFetch(morphOffsets, ivec2(texel % MORPH_TEXTURE_WIDTH, texel / MORPH_TEXTURE_WIDTH), 0).xyz;
+    }
+#endif
+    return position;
+}
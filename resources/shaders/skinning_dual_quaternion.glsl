@@ -0,0 +1,46 @@
+// Dual quaternion skinning, rigid bones only, scale is dropped, after bone_influences.glsl
+
+#ifdef DUAL_QUATERNION
+// Two entries per bone: real part (rotation) then dual part (translation), xyzw
+uniform vec4 finalBonesDualQuats[MAX_BONES * 2];
+
+vec4 blendReal;
+vec4 blendDual;
+
+void addInfluence(int boneId, float weight){
+    int bone = clamp(boneId, 0, MAX_BONES - 1);
+    vec4 real = finalBonesDualQuats[bone * 2];
+    vec4 dual = finalBonesDualQuats[bone * 2 + 1];
+    
+    // q and -q are the same rotation, keep every influence on the same side as the
+    // heaviest one, added first, or the blend goes the long way round
+    if(dot(blendReal, real) < 0.0f){
+        weight = -weight;
+    }
+    blendReal += real * weight;
+    blendDual += dual * weight;
+}
+
+vec4 skinPosition(vec4 position){
+    if(!influencesInPalette()){
+        return position;
+    }
+    blendReal = vec4(0.0f);
+    blendDual = vec4(0.0f);
+    addInfluences();
+    
+    // Vertices no bone moves keep their bind pose
+    if(dot(blendReal, blendReal) == 0.0f){
+        return position;
+    }
+    float norm = length(blendReal);
+    blendReal /= norm;
+    blendDual /= norm;
+    
+    // Rotate by the real part, then translate by 2 * dual * conjugate(real)
+    vec3 skinned = position.xyz;
+    skinned += 2.0f * cross(blendReal.xyz, cross(blendReal.xyz, skinned) + blendReal.w * skinned);
+    skinned += 2.0f * (blendReal.w * blendDual.xyz - blendDual.w * blendReal.xyz + cross(blendReal.xyz, blendDual.xyz));
+    return vec4(skinned, 1.0f);
+}
+#endif
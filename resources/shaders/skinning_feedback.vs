@@ -0,0 +1,41 @@
+#version 330 core
+
+// Skins every vertex once per frame into a buffer through transform feedback, the
+// passes drawing the character afterwards use mesh.vs without features
+
+// In Attributes
+layout(location = 0) in vec3 aPos;  // Vertex Position
+layout(location = 1) in vec3 aNorm; // Normal Position
+layout(location = 3) in ivec4 boneIds;      // Bone Ids
+layout(location = 4) in vec4 weights;       // Weights of the muscles
+layout(location = 5) in ivec4 boneIds2;     // Bone Ids of influences 5 to 8
+layout(location = 6) in vec4 weights2;      // Their weights
+
+const int MAX_BONES = 100;
+uniform mat4 finalBonesMatrices[MAX_BONES];
+
+// Captured Outputs, interleaved in the skinned vertex buffer
+out vec3 skinnedPosition;
+out vec3 skinnedNormal;
+
+// Runs once per vertex and frame, so it reads all 8 slots rather than using a variant per bucket
+void addInfluence(int boneId, float weight, inout vec4 totalPosition, inout vec3 totalNormal){
+    mat4 bone = finalBonesMatrices[clamp(boneId, 0, MAX_BONES - 1)];
+    totalPosition += bone * vec4(aPos, 1.0f) * weight;
+    totalNormal += mat3(bone) * aNorm * weight;
+}
+
+void main(){
+    vec4 totalPosition = vec4(0.0f);
+    vec3 totalNormal = vec3(0.0f);
+    for(int i=0; i<4; i++){
+        addInfluence(boneIds[i], weights[i], totalPosition, totalNormal);
+        addInfluence(boneIds2[i], weights2[i], totalPosition, totalNormal);
+    }
+    
+    // Influences are stored heaviest first, vertices no bone moves keep their bind pose and
+    // so do those referencing a slot past the palette, from a mesh the loader could not split
+    bool skinned = boneIds[0] >= 0 && all(lessThan(boneIds, ivec4(MAX_BONES))) && all(lessThan(boneIds2, ivec4(MAX_BONES)));
+    skinnedPosition = skinned ? totalPosition.xyz : aPos;
+    skinnedNormal = skinned ? normalize(totalNormal) : aNorm;
+}
@@ -0,0 +1,38 @@
+// Linear blend skinning, one mat4 per bone, after bone_influences.glsl
+
+#ifdef SKINNED
+uniform mat4 finalBonesMatrices[MAX_BONES];
+#ifdef PALETTE_BLEND
+uniform mat4 previousBonesMatrices[MAX_BONES];  // Palette of the update before the last one
+uniform float paletteBlend;                     // 0 = previous palette, 1 = latest palette
+#endif
+
+vec4 skinnedInput;
+vec4 totalPosition;
+vec4 previousPosition;
+
+// Clamping keeps the read of unused slots in range
+void addInfluence(int boneId, float weight){
+    int bone = clamp(boneId, 0, MAX_BONES - 1);
+    totalPosition += finalBonesMatrices[bone] * skinnedInput * weight;
+#ifdef PALETTE_BLEND
+    // Skin with both palettes and blend the results, cheaper than blending the matrices
+    previousPosition += previousBonesMatrices[bone] * skinnedInput * weight;
+#endif
+}
+
+vec4 skinPosition(vec4 position){
+    if(!influencesInPalette()){
+        return position;
+    }
+    skinnedInput = position;
+    totalPosition = vec4(0.0f);
+    previousPosition = vec4(0.0f);
+    addInfluences();
+#ifdef PALETTE_BLEND
+    return mix(previousPosition, totalPosition, paletteBlend);
+#else
+    return totalPosition;
+#endif
+}
+#endif